@@ -1,6 +1,6 @@
 /**
  * Basic Environment for Game 2048
- * use 'g++ -std=c++11 -O3 -g -o 2048 2048.cpp' to compile the source
+ * use 'g++ -std=c++14 -O3 -g -o Three Three.cpp' to compile the source
  *
  * Computer Games and Intelligence (CGI) Lab, NCTU, Taiwan
  * http://www.aigames.nctu.edu.tw
@@ -11,21 +11,58 @@
 #include <iterator>
 #include <string>
 #include <sstream>
+#include <random>
+#include <numeric>
+#include <chrono>
+#include <mutex>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
 #include "episode.h"
 #include "statistic.h"
+#include "corpus.h"
+#include "server.h"
+#include "metrics.h"
+#include "rollout.h"
+#include "executor.h"
 
-int main(int argc, const char* argv[]) {
+/**
+ * the arguments of a player that shares the tables of the main one, without the options
+ * that create, load, or write the tables or any other file, or report the usage, which
+ * is merged into the main player after each game
+ */
+std::string worker_args(const std::string& args) {
+	std::stringstream ss(args);
+	std::string kept;
+	for (std::string pair; ss >> pair; ) {
+		std::string key = pair.substr(0, pair.find('='));
+		for (const char* drop : { "init", "load", "mmap", "save", "checkpoint", "every", "interval", "dump", "stats", "pin", "cache" })
+			if (key == drop) key.clear();
+		if (key.size()) kept += pair + " ";
+	}
+	return kept;
+}
+
+/**
+ * the value of an option in the arguments of an agent, or empty if it is not given
+ */
+std::string find_arg(const std::string& args, const std::string& key) {
+	std::stringstream ss(args);
+	for (std::string pair; ss >> pair; )
+		if (pair.substr(0, pair.find('=')) == key) return pair.substr(pair.find('=') + 1);
+	return "";
+}
+
+int main(int argc, const char* argv[]) try {
 	std::cout << "Three-Demo: ";
 	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
 	std::cout << std::endl << std::endl;
 
 	size_t total = 1000, block = 0, limit = 0;
-	std::string play_args, evil_args;
-	std::string load, save;
-	bool summary = false;
+	std::string play_args, evil_args, rollout_args;
+	std::string load, save, replay, serve, seed, export_path;
+	size_t epoch = 1, batch = 1024, shuffle = 0, threads = 1;
+	bool summary = false, resume = false, search = false, skim = false;
 	for (int i = 1; i < argc; i++) {
 		std::string para(argv[i]);
 		if (para.find("--total=") == 0) {
@@ -44,41 +81,174 @@ int main(int argc, const char* argv[]) {
 			save = para.substr(para.find("=") + 1);
 		} else if (para.find("--summary") == 0) {
 			summary = true;
+		} else if (para.find("--thread=") == 0) {
+			threads = std::max(std::stoull(para.substr(para.find("=") + 1)), 1ull);
+		} else if (para.find("--skim") == 0) {
+			skim = true;
+		} else if (para.find("--resume") == 0) {
+			resume = true;
+		} else if (para.find("--replay=") == 0) {
+			replay = para.substr(para.find("=") + 1);
+		} else if (para.find("--epoch=") == 0) {
+			epoch = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--batch=") == 0) {
+			batch = std::max(std::stoull(para.substr(para.find("=") + 1)), 1ull);
+		} else if (para.find("--serve=") == 0) {
+			serve = para.substr(para.find("=") + 1);
+		} else if (para.find("--seed=") == 0) {
+			seed = para.substr(para.find("=") + 1);
+		} else if (para.find("--rollout") == 0) {
+			rollout_args = para.find("=") != std::string::npos ? para.substr(para.find("=") + 1) : "";
+			search = true;
+		} else if (para.find("--metrics=") == 0) {
+			export_path = para.substr(para.find("=") + 1);
+		} else if (para.find("--shuffle") == 0) {
+			shuffle = para.find("=") != std::string::npos ? std::stoull(para.substr(para.find("=") + 1)) : 1;
 		}
 	}
 
+	if (seed.size()) { // deterministic mode: seeded games and no wall clock in the records
+		evil_args += " seed=" + seed;
+		episode::clocked() = false;
+	}
+
 	statistic stat(total, block, limit);
 
+	std::unique_ptr<metrics::writer> exporter;
+	if (export_path.size()) exporter.reset(new metrics::writer(export_path)); // the counters in the Prometheus text format
+
+	if (load.size() && skim) { // only the summary of the records, without replaying the games
+		stat.load(load, false);
+		stat.summary();
+		return 0;
+	}
+
 	if (load.size()) {
-		std::ifstream in(load, std::ios::in);
-		in >> stat;
-		in.close();
+		stat.load(load);
 		summary |= stat.is_finished();
 	}
 
 	player play(play_args);
+
+	if (serve.size()) { // answer move queries until terminated
+		server host(play, serve);
+		if (!host.run()) std::cerr << "serve: cannot listen on " << serve << std::endl;
+		return 0;
+	}
+
+	if (replay.size()) { // offline training on a recorded corpus instead of self-play
+		corpus data(replay);
+		std::vector<size_t> order(data.size());
+		std::iota(order.begin(), order.end(), 0);
+		if (!shuffle) data.sequential();
+		for (size_t e = 1; e <= epoch; e++) {
+			auto start = std::chrono::steady_clock::now();
+			if (shuffle) std::shuffle(order.begin(), order.end(), std::mt19937_64(shuffle + e));
+			size_t steps = 0;
+			for (size_t i = 0; i < order.size(); i += batch) {
+				size_t last = std::min(i + batch, order.size());
+				if (shuffle) for (size_t j = i; j < last; j++) data.prefetch(order[j]);
+				for (size_t j = i; j < last; j++) {
+					play.replay_train(data.trajectory(order[j]), data.steps(order[j]));
+					play.close_episode("replay");
+					steps += data.steps(order[j]);
+				}
+			}
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			std::cout << "epoch " << e << "\t" << order.size() << " episodes, " << steps << " steps, ";
+			std::cout << std::fixed << std::setprecision(0) << (steps / elapsed.count()) << " steps/s" << std::endl;
+			std::cout << std::defaultfloat;
+		}
+		return 0;
+	}
+
 	rndenv evil(evil_args);
 
-	int cur_hint;
+	std::unique_ptr<rollout> planner; // the slides are taken by playouts, and nothing is trained
+	if (search) planner.reset(new rollout(rollout_args + (seed.size() ? " seed=" + seed : ""), &play));
+	agent& mover = planner ? static_cast<agent&>(*planner) : play;
+
+	size_t resumed = 0;
+	if (resume) {
+		stat.resume(play.resume());
+		resumed = total - stat.remaining();
+		evil.seek(resumed); // a seeded run continues with the game it stopped at
+	}
+
+	if (threads > 1 && !planner) { // parallel games by per-worker agents, which share the tables of the player
+		std::vector<std::unique_ptr<player>> players;
+		std::vector<std::unique_ptr<rndenv>> envs;
+		for (size_t w = 0; w < threads; w++) {
+			players.emplace_back(new player(worker_args(play_args)));
+			players.back()->share(play);
+			std::string stream = seed.size() ? "" : " seed=" + std::to_string(std::random_device()() & 0x7fffffff) + " worker=" + std::to_string(w);
+			envs.emplace_back(new rndenv(evil_args + stream)); // unseeded runs need a distinct stream for each worker
+		}
+		std::mutex merge;
+		std::vector<int> cpus = numa::parse_list(find_arg(play_args, "pin"));
+		executor pool(threads, [&](size_t w) { // the cpus of pin= are split over the workers
+			if (cpus.size() && !numa::pin(numa::part(cpus, w, threads)))
+				std::cerr << "pin: cannot bind worker " << w << " to its part of cpus " << find_arg(play_args, "pin") << std::endl;
+		});
+		for (size_t g = 0, n = stat.remaining(); g < n; g++) {
+			pool.submit([&, g](size_t w) {
+				player& play_w = *players[w];
+				rndenv& evil_w = *envs[w];
+				evil_w.seek(resumed + g); // a seeded game does not depend on the worker that plays it
+				play_w.open_episode("~:" + evil_w.name());
+				evil_w.open_episode(play_w.name() + ":~");
+
+				episode game;
+				game.open_episode(play_w.name() + ":" + evil_w.name());
+				int hint = 0;
+				while (true) {
+					agent& who = game.take_turns(play_w, evil_w);
+					if (&who == &play_w && !game.state().legal_moves()) break;
+					action move = who.take_action(game.state(), hint);
+					if (game.apply_action(move) != true) break;
+					if (who.check_for_win(game.state())) break;
+				}
+				agent& win = game.last_turns(play_w, evil_w);
+
+				play_w.backward_train();
+
+				game.close_episode(win.name());
+				metrics::instance().game(game.score(), game.state().max_cell(), game.step(action::slide::type));
+				play_w.close_episode(win.name());
+				evil_w.close_episode(win.name());
+				evil_w.reset_bag();
+
+				std::lock_guard<std::mutex> guard(merge);
+				stat.add(std::move(game));
+				play.merge(play_w); // the usage, the hot tier hits, and the danger counts
+				play.close_episode(win.name()); // the episode count, the schedule, and the checkpoints
+				play_w.follow(play);
+			});
+		}
+	}
+
+	int cur_hint = 0;
 	while (!stat.is_finished()) {
-		play.open_episode("~:" + evil.name());
-		evil.open_episode(play.name() + ":~");
+		mover.open_episode("~:" + evil.name());
+		evil.open_episode(mover.name() + ":~");
 
-		stat.open_episode(play.name() + ":" + evil.name());
+		stat.open_episode(mover.name() + ":" + evil.name());
 		episode& game = stat.back();	
 
 		while (true) {
-			agent& who = game.take_turns(play, evil);
+			agent& who = game.take_turns(mover, evil);
+			if (&who == &mover && !game.state().legal_moves()) break; // no slide is left
 			action move = who.take_action(game.state(), cur_hint);
 			if (game.apply_action(move) != true) break;
 			if (who.check_for_win(game.state())) break;
 		}
-		agent& win = game.last_turns(play, evil);
+		agent& win = game.last_turns(mover, evil);
 		
-		play.backward_train();
+		if (!planner) play.backward_train();
 
 		stat.close_episode(win.name());
-		play.close_episode(win.name());
+		metrics::instance().game(game.score(), game.state().max_cell(), game.step(action::slide::type));
+		mover.close_episode(win.name());
 		evil.close_episode(win.name());
 		evil.reset_bag();
 	}
@@ -94,4 +264,7 @@ int main(int argc, const char* argv[]) {
 	}
 
 	return 0;
+} catch (const std::runtime_error& e) { // e.g., a weight file that cannot be loaded
+	std::cerr << e.what() << std::endl;
+	return -1;
 }
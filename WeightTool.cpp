@@ -0,0 +1,487 @@
+/**
+ * Offline Tools for the Weight Files of Three
+ * use 'g++ -std=c++14 -O3 -g -o WeightTool WeightTool.cpp' to compile the source
+ *
+ * compact: rewrite a weight file with the tables in the blocked sparse layout, where the
+ *          near-zero entries may be pruned, then report the size and the score difference
+ * diff:    write the blocks that changed from a base weight file to a target one as a delta
+ * patch:   rebuild the target weight file from the base one and a delta, verified by checksums
+ * chain:   merge successive deltas into one that takes the first base to the last target
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <cstdio>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+
+/**
+ * the delta between two weight files with the same tables
+ *
+ * the delta starts with a header (signature, table count, layout and trained episodes of
+ * the target, block size, digests of the base and the target, and the trained episodes of
+ * the target when its run started), then each table has its
+ * length and its changed block count, followed by the changed blocks in order, each with
+ * its index, its checksums in the base and in the target, and its entries in the target
+ */
+struct delta_head {
+	uint32_t magic;
+	uint16_t size;
+	uint16_t layout;
+	uint64_t episode;
+	uint32_t block; // entries per block
+	uint32_t reserved;
+	uint64_t base;   // the digest of the base tables
+	uint64_t target; // the digest of the target tables
+	uint64_t origin; // the trained episodes of the target when its run started
+};
+struct delta_block {
+	uint64_t index;
+	uint64_t base;   // the checksum of the block in the base
+	uint64_t target; // the checksum of the block in the target
+};
+static constexpr uint32_t delta_signature = 0x4C445754; // "TWDL"
+static constexpr uint64_t digest_basis = 0xcbf29ce484222325ull;
+
+static uint64_t mix(uint64_t hash, uint64_t word) {
+	hash = (hash ^ word) * 0x100000001b3ull;
+	return hash ^ (hash >> 32);
+}
+
+/**
+ * the checksum of a block of entries, FNV-1a over 64-bit words; the digest of the tables
+ * mixes the checksums of all their blocks in the same way
+ */
+static uint64_t checksum(const float* data, size_t n) {
+	const char* bytes = reinterpret_cast<const char*>(data);
+	size_t len = sizeof(float) * n, i = 0;
+	uint64_t hash = digest_basis;
+	for (uint64_t word; i + sizeof(word) <= len; i += sizeof(word)) {
+		std::memcpy(&word, bytes + i, sizeof(word));
+		hash = mix(hash, word);
+	}
+	for (uint32_t word; i < len; i += sizeof(word)) {
+		std::memcpy(&word, bytes + i, sizeof(word));
+		hash = mix(hash, word);
+	}
+	return hash;
+}
+
+/**
+ * a weight file opened without any feature, only the tables are of interest
+ */
+class weight_file : public weight_agent {
+public:
+	weight_file(const std::string& path) : weight_agent("name=file role=tool alpha=0 mmap=1 load=" + path) {}
+
+	/**
+	 * write all the tables in the sparse layout, and return the summed statistics
+	 */
+	weight::sparse_info compact(const std::string& path, uint32_t block, float eps) const {
+		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) std::exit(-1);
+		header head = { sparse_signature, uint16_t(net.size()), uint16_t(layout), episode, saved_origin };
+		out.write(reinterpret_cast<char*>(&head), header_size(head.magic));
+		weight::sparse_info total = { 0, 0, 0, 0 };
+		for (const weight& w : net) {
+			weight::sparse_info info = w.write_sparse(out, block, eps);
+			total.blocks += info.blocks;
+			total.stored += info.stored;
+			total.kept += info.kept;
+			total.pruned += info.pruned;
+		}
+		return total;
+	}
+
+	const weight& table(size_t i) const { return net[i]; }
+
+	/**
+	 * whether the other file has the same tables, i.e., a delta can take one to the other
+	 */
+	bool matches(const weight_file& other) const {
+		if (net.size() != other.net.size()) return false;
+		for (size_t i = 0; i < net.size(); i++)
+			if (net[i].size() != other.net[i].size()) return false;
+		return true;
+	}
+
+	/**
+	 * write the blocks that differ in the target as a delta, and return the changed blocks
+	 * the tables are compared block by block, so that only two blocks are held at a time
+	 */
+	size_t diff(const weight_file& target, const std::string& path, uint32_t block) const {
+		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) std::exit(-1);
+		delta_head head = { delta_signature, uint16_t(net.size()), uint16_t(target.layout), target.episode, block, 0, digest_basis, digest_basis, target.saved_origin };
+		out.write(reinterpret_cast<char*>(&head), sizeof(head)); // the digests are rewritten at the end
+		std::vector<float> before(block), after(block);
+		size_t total = 0;
+		for (size_t t = 0; t < net.size(); t++) {
+			uint64_t length = net[t].size(), changed = 0;
+			std::streampos count = out.tellp() + std::streamoff(sizeof(length));
+			out.write(reinterpret_cast<char*>(&length), sizeof(length));
+			out.write(reinterpret_cast<char*>(&changed), sizeof(changed));
+			for (uint64_t first = 0; first < length; first += block) {
+				size_t n = std::min<uint64_t>(block, length - first);
+				net[t].copy(before.data(), first, n);
+				target.net[t].copy(after.data(), first, n);
+				delta_block rec = { first / block, checksum(before.data(), n), checksum(after.data(), n) };
+				head.base = mix(head.base, rec.base);
+				head.target = mix(head.target, rec.target);
+				if (std::memcmp(before.data(), after.data(), sizeof(float) * n) == 0) continue;
+				out.write(reinterpret_cast<char*>(&rec), sizeof(rec));
+				out.write(reinterpret_cast<char*>(after.data()), sizeof(float) * n);
+				changed++;
+			}
+			std::streampos end = out.tellp();
+			out.seekp(count);
+			out.write(reinterpret_cast<char*>(&changed), sizeof(changed));
+			out.seekp(end);
+			total += changed;
+		}
+		out.seekp(0);
+		out.write(reinterpret_cast<char*>(&head), sizeof(head));
+		out.close();
+		return total;
+	}
+
+	/**
+	 * write the tables of this file with the blocks of a delta applied, as a dense weight file
+	 * every changed block must match its base checksum before it is replaced, and the digests
+	 * of the base and the result must match those of the delta, otherwise nothing is written
+	 */
+	bool patch(const std::string& path, const std::string& result, size_t& applied) const {
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		delta_head head;
+		if (!in.read(reinterpret_cast<char*>(&head), sizeof(head)) || head.magic != delta_signature || head.block == 0) {
+			std::cerr << "patch: " << path << " is not a delta" << std::endl;
+			return false;
+		}
+		if (head.size != net.size()) {
+			std::cerr << "patch: the delta has " << head.size << " tables, the base has " << net.size() << std::endl;
+			return false;
+		}
+		std::string temp = result + ".tmp";
+		std::ofstream out(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) std::exit(-1);
+		header file = { run_signature, head.size, head.layout, head.episode, head.origin };
+		out.write(reinterpret_cast<char*>(&file), sizeof(file));
+		uint64_t base = digest_basis, target = digest_basis;
+		std::vector<float> buf(head.block);
+		bool valid = true;
+		applied = 0;
+		for (size_t t = 0; t < net.size() && valid; t++) {
+			uint64_t length = 0, changed = 0;
+			in.read(reinterpret_cast<char*>(&length), sizeof(length));
+			in.read(reinterpret_cast<char*>(&changed), sizeof(changed));
+			if (!in || length != net[t].size()) {
+				std::cerr << "patch: table " << t << " of the delta does not fit the base" << std::endl;
+				valid = false;
+				break;
+			}
+			out.write(reinterpret_cast<char*>(&length), sizeof(length));
+			delta_block rec = { ~0ull, 0, 0 };
+			if (changed && !in.read(reinterpret_cast<char*>(&rec), sizeof(rec))) rec.index = ~0ull;
+			for (uint64_t first = 0, b = 0; first < length; first += head.block, b++) {
+				size_t n = std::min<uint64_t>(head.block, length - first);
+				net[t].copy(buf.data(), first, n);
+				uint64_t sum = checksum(buf.data(), n);
+				base = mix(base, sum);
+				if (rec.index == b) {
+					if (sum != rec.base) {
+						std::cerr << "patch: block " << b << " of table " << t << " does not match the base of the delta" << std::endl;
+						valid = false;
+						break;
+					}
+					in.read(reinterpret_cast<char*>(buf.data()), sizeof(float) * n);
+					sum = checksum(buf.data(), n);
+					if (!in || sum != rec.target) {
+						std::cerr << "patch: block " << b << " of table " << t << " is corrupted in the delta" << std::endl;
+						valid = false;
+						break;
+					}
+					applied++;
+					if (--changed == 0 || !in.read(reinterpret_cast<char*>(&rec), sizeof(rec))) rec.index = ~0ull;
+				}
+				target = mix(target, sum);
+				out.write(reinterpret_cast<char*>(buf.data()), sizeof(float) * n);
+			}
+			if (valid && changed) {
+				std::cerr << "patch: table " << t << " of the delta has blocks out of order or out of range" << std::endl;
+				valid = false;
+			}
+		}
+		if (valid && base != head.base) std::cerr << "patch: the base does not match the delta" << std::endl, valid = false;
+		if (valid && target != head.target) std::cerr << "patch: the result does not match the delta" << std::endl, valid = false;
+		out.close();
+		valid = valid && out && std::rename(temp.c_str(), result.c_str()) == 0;
+		if (!valid) std::remove(temp.c_str());
+		return valid;
+	}
+};
+
+/**
+ * a delta held in memory, i.e., the changed blocks of each table by index
+ */
+struct delta {
+	struct change {
+		delta_block rec;
+		std::vector<float> data;
+	};
+	delta_head head;
+	std::vector<uint64_t> lengths;
+	std::vector<std::map<uint64_t, change>> tables;
+
+	bool read(const std::string& path) {
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		if (!in.read(reinterpret_cast<char*>(&head), sizeof(head)) || head.magic != delta_signature || head.block == 0) return false;
+		lengths.assign(head.size, 0);
+		tables.assign(head.size, {});
+		for (size_t t = 0; t < head.size; t++) {
+			uint64_t changed = 0;
+			in.read(reinterpret_cast<char*>(&lengths[t]), sizeof(uint64_t));
+			in.read(reinterpret_cast<char*>(&changed), sizeof(uint64_t));
+			for (uint64_t i = 0; i < changed && in; i++) {
+				change c;
+				in.read(reinterpret_cast<char*>(&c.rec), sizeof(c.rec));
+				uint64_t first = c.rec.index * head.block;
+				if (first >= lengths[t]) return false;
+				c.data.resize(std::min<uint64_t>(head.block, lengths[t] - first));
+				in.read(reinterpret_cast<char*>(c.data.data()), sizeof(float) * c.data.size());
+				if (checksum(c.data.data(), c.data.size()) != c.rec.target) return false;
+				tables[t][c.rec.index] = std::move(c);
+			}
+		}
+		return bool(in);
+	}
+	bool write(const std::string& path) const {
+		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) return false;
+		out.write(reinterpret_cast<const char*>(&head), sizeof(head));
+		for (size_t t = 0; t < head.size; t++) {
+			uint64_t changed = tables[t].size();
+			out.write(reinterpret_cast<const char*>(&lengths[t]), sizeof(uint64_t));
+			out.write(reinterpret_cast<const char*>(&changed), sizeof(uint64_t));
+			for (const auto& block : tables[t]) {
+				out.write(reinterpret_cast<const char*>(&block.second.rec), sizeof(block.second.rec));
+				out.write(reinterpret_cast<const char*>(block.second.data.data()), sizeof(float) * block.second.data.size());
+			}
+		}
+		out.close();
+		return bool(out);
+	}
+
+	/**
+	 * follow this delta by the next one, which must start from the target of this one
+	 * a block changed by both keeps the base checksum of this one and the entries of the next
+	 */
+	bool append(delta&& next) {
+		if (next.head.base != head.target || next.head.block != head.block || next.lengths != lengths) return false;
+		for (size_t t = 0; t < tables.size(); t++) {
+			for (auto& block : next.tables[t]) {
+				auto it = tables[t].find(block.first);
+				if (it != tables[t].end()) block.second.rec.base = it->second.rec.base;
+				tables[t][block.first] = std::move(block.second);
+			}
+		}
+		head.layout = next.head.layout;
+		head.episode = next.head.episode;
+		head.origin = next.head.origin;
+		head.target = next.head.target;
+		return true;
+	}
+
+	size_t blocks() const {
+		size_t total = 0;
+		for (const auto& table : tables) total += table.size();
+		return total;
+	}
+};
+
+/**
+ * the average score of seeded games played greedily with the given weights
+ */
+double evaluate(const std::string& path, size_t games, const std::string& seed) {
+	player play("alpha=0 mmap=1 load=" + path);
+	rndenv evil("seed=" + seed);
+	double sum = 0;
+	int hint = 0;
+	for (size_t i = 0; i < games; i++) {
+		play.open_episode();
+		evil.open_episode();
+		episode game;
+		while (true) {
+			agent& who = game.take_turns(play, evil);
+			if (&who == &play && !game.state().legal_moves()) break;
+			if (game.apply_action(who.take_action(game.state(), hint)) != true) break;
+		}
+		play.backward_train();
+		play.close_episode();
+		evil.close_episode();
+		evil.reset_bag();
+		sum += game.score();
+	}
+	return games ? sum / games : 0;
+}
+
+static size_t file_size(const std::string& path) {
+	std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+	return in.is_open() ? size_t(in.tellg()) : 0;
+}
+
+int compact(int argc, const char* argv[]) {
+	std::string in, out, seed = "1";
+	uint32_t block = 256;
+	float eps = 0;
+	size_t games = 0;
+	for (int i = 2; i < argc; i++) {
+		std::string para(argv[i]);
+		if (para.find("--in=") == 0) {
+			in = para.substr(para.find("=") + 1);
+		} else if (para.find("--out=") == 0) {
+			out = para.substr(para.find("=") + 1);
+		} else if (para.find("--block=") == 0) {
+			block = std::stoul(para.substr(para.find("=") + 1));
+		} else if (para.find("--eps=") == 0) {
+			eps = std::stof(para.substr(para.find("=") + 1));
+		} else if (para.find("--games=") == 0) {
+			games = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--seed=") == 0) {
+			seed = para.substr(para.find("=") + 1);
+		}
+	}
+	if (in.empty() || out.empty() || block == 0 || (block & (block - 1))) {
+		std::cerr << "compact: --in= and --out= are required, and --block= must be a power of 2" << std::endl;
+		return 1;
+	}
+
+	weight::sparse_info info = weight_file(in).compact(out, block, eps);
+	size_t dense = file_size(in), sparse = file_size(out);
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "dense = " << dense << " bytes, sparse = " << sparse << " bytes";
+	std::cout << ", ratio = " << (sparse ? double(dense) / sparse : 0) << "x" << std::endl;
+	std::cout << "blocks = " << info.stored << "/" << info.blocks << ", kept = " << info.kept;
+	std::cout << ", pruned = " << info.pruned << " (|w| <= " << std::defaultfloat << eps << ")" << std::endl;
+
+	if (games) {
+		std::cout << std::fixed;
+		double before = evaluate(in, games, seed), after = evaluate(out, games, seed);
+		std::cout << "games = " << games << ", dense avg = " << before << ", sparse avg = " << after;
+		std::cout << ", delta = " << (after - before) << std::endl;
+	}
+	return 0;
+}
+
+int diff(int argc, const char* argv[]) {
+	std::string base, target, out;
+	uint32_t block = 4096;
+	for (int i = 2; i < argc; i++) {
+		std::string para(argv[i]);
+		if (para.find("--base=") == 0) {
+			base = para.substr(para.find("=") + 1);
+		} else if (para.find("--target=") == 0) {
+			target = para.substr(para.find("=") + 1);
+		} else if (para.find("--out=") == 0) {
+			out = para.substr(para.find("=") + 1);
+		} else if (para.find("--block=") == 0) {
+			block = std::stoul(para.substr(para.find("=") + 1));
+		}
+	}
+	if (base.empty() || target.empty() || out.empty() || block == 0) {
+		std::cerr << "diff: --base=, --target=, and --out= are required, and --block= must be positive" << std::endl;
+		return 1;
+	}
+
+	weight_file from(base), to(target);
+	if (!from.matches(to)) {
+		std::cerr << "diff: " << base << " and " << target << " have different tables" << std::endl;
+		return 1;
+	}
+	size_t changed = from.diff(to, out, block), blocks = 0;
+	for (size_t t = 0; t < from.tables(); t++) blocks += (from.table(t).size() + block - 1) / block;
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "blocks = " << changed << "/" << blocks << " (" << (blocks ? 100.0 * changed / blocks : 0) << "%)";
+	std::cout << ", delta = " << file_size(out) << " bytes, target = " << file_size(target) << " bytes" << std::endl;
+	return 0;
+}
+
+int patch(int argc, const char* argv[]) {
+	std::string base, path, out;
+	for (int i = 2; i < argc; i++) {
+		std::string para(argv[i]);
+		if (para.find("--base=") == 0) {
+			base = para.substr(para.find("=") + 1);
+		} else if (para.find("--delta=") == 0) {
+			path = para.substr(para.find("=") + 1);
+		} else if (para.find("--out=") == 0) {
+			out = para.substr(para.find("=") + 1);
+		}
+	}
+	if (base.empty() || path.empty() || out.empty()) {
+		std::cerr << "patch: --base=, --delta=, and --out= are required" << std::endl;
+		return 1;
+	}
+
+	size_t applied = 0;
+	if (!weight_file(base).patch(path, out, applied)) return 1;
+	std::cout << "blocks = " << applied << ", checksums OK" << std::endl;
+	return 0;
+}
+
+int chain(int argc, const char* argv[]) {
+	std::string out;
+	std::vector<std::string> paths;
+	for (int i = 2; i < argc; i++) {
+		std::string para(argv[i]);
+		if (para.find("--out=") == 0) {
+			out = para.substr(para.find("=") + 1);
+		} else {
+			paths.push_back(para);
+		}
+	}
+	if (out.empty() || paths.empty()) {
+		std::cerr << "chain: --out= and at least one delta are required" << std::endl;
+		return 1;
+	}
+
+	delta merged;
+	for (size_t i = 0; i < paths.size(); i++) {
+		delta next;
+		if (!next.read(paths[i])) {
+			std::cerr << "chain: " << paths[i] << " is not a valid delta" << std::endl;
+			return 1;
+		}
+		if (i == 0) {
+			merged = std::move(next);
+		} else if (!merged.append(std::move(next))) {
+			std::cerr << "chain: " << paths[i] << " does not start from the target of " << paths[i - 1] << std::endl;
+			return 1;
+		}
+	}
+	if (!merged.write(out)) std::exit(-1);
+	std::cout << "deltas = " << paths.size() << ", blocks = " << merged.blocks() << ", delta = " << file_size(out) << " bytes" << std::endl;
+	return 0;
+}
+
+int main(int argc, const char* argv[]) try {
+	std::string command = argc > 1 ? argv[1] : "";
+	if (command == "compact") return compact(argc, argv);
+	if (command == "diff") return diff(argc, argv);
+	if (command == "patch") return patch(argc, argv);
+	if (command == "chain") return chain(argc, argv);
+	std::cerr << "usage: " << argv[0] << " compact --in=<file> --out=<file> [--eps=0] [--block=256] [--games=0] [--seed=1]" << std::endl;
+	std::cerr << "       " << argv[0] << " diff --base=<file> --target=<file> --out=<delta> [--block=4096]" << std::endl;
+	std::cerr << "       " << argv[0] << " patch --base=<file> --delta=<delta> --out=<file>" << std::endl;
+	std::cerr << "       " << argv[0] << " chain --out=<delta> <delta> <delta>..." << std::endl;
+	return 1;
+} catch (const std::runtime_error& e) { // e.g., a weight file that cannot be loaded
+	std::cerr << e.what() << std::endl;
+	return -1;
+}
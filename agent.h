@@ -1,16 +1,32 @@
 #pragma once
 #include <string>
+#include <cstddef>
 #include <random>
 #include <sstream>
 #include <map>
 #include <unordered_map>
 #include <type_traits>
 #include <algorithm>
+#include <numeric>
 #include <cmath>
 #include <fstream>
+#include <iomanip>
+#include <memory>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
 #include "board.h"
 #include "action.h"
 #include "weight.h"
+#include "corpus.h"
+#include "metrics.h"
 
 class agent {
 public:
@@ -47,12 +63,40 @@ protected:
 
 class random_agent : public agent {
 public:
-	random_agent(const std::string& args = "") : agent(args), unif(0.0, 1.0) {
-		if (meta.find("seed") != meta.end())
+	random_agent(const std::string& args = "") : agent(args), unif(0.0, 1.0), seeded(false), run(0), worker(0), game(0) {
+		if (meta.find("seed") != meta.end()) { // pass seed=... to derive a seed for each game
+			seeded = true;
+			run = uint64_t(meta["seed"]);
 			engine.seed(int(meta["seed"]));
+		}
+		if (meta.find("worker") != meta.end()) // pass worker=... to separate the streams of parallel agents
+			worker = uint64_t(meta["worker"]);
 	}
 	virtual ~random_agent() {}
 
+	/**
+	 * restart the engine from the seed of the next game, seed(run, worker, game),
+	 * so that a game can be reproduced without replaying the games before it
+	 */
+	virtual void open_episode(const std::string& flag = "") {
+		if (seeded) engine.seed(std::default_random_engine::result_type(derive(derive(derive(run) ^ worker) ^ game++)));
+	}
+
+	/**
+	 * play the given game next, the seed then does not depend on the games played before
+	 */
+	void seek(uint64_t next) { game = next; }
+
+	/**
+	 * the splitmix64 finalizer
+	 */
+	static uint64_t derive(uint64_t x) {
+		x += 0x9e3779b97f4a7c15ull;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+		return x ^ (x >> 31);
+	}
+
 protected:
 	float create_random_number() {
 		return unif(engine);
@@ -61,54 +105,663 @@ protected:
 protected:
 	std::default_random_engine engine;
 	std::uniform_real_distribution<float> unif;
+	bool seeded;
+	uint64_t run;
+	uint64_t worker;
+	uint64_t game;
 };
 
 /**
  * base agent for agents with weight tables
+ *
+ * the weight file starts with a header (signature, table count, trained episodes, and the
+ * trained episodes when the run that wrote it started) followed by the tables, files without
+ * the signature are loaded as legacy dumps
  */
 class weight_agent : public agent {
 public:
-	weight_agent(const std::string& args = "") : agent(args), alpha(0.1f) {
-		if (meta.find("init") != meta.end()) // pass init=... to initialize the weight
-			init_weights(meta["init"]);
-		if (meta.find("load") != meta.end()) // pass load=... to load from a specific file
-			load_weights(meta["load"]);
+	weight_agent(const std::string& args = "") : agent(args), alpha(0.1f), placement(numa::interleave), layout(split),
+		schedule(constant), rate(0.1f), decay(0.5f), period(1000000), monitor(0),
+		cache_hits(0), cache_misses(0), follower(false),
+		episode(0), origin(0), saved_origin(0), every(0), interval(0), snapshot(0), last_snapshot(std::chrono::steady_clock::now()),
+		snapshot_episode(0), snapshot_due(false), requests(0), followers(0), synced(0), synced_request(0),
+		buffer(0), batched(0), busy(false), quit(false) {
+		if (meta.find("pin") != meta.end() && !numa::pin(meta["pin"])) // pass pin=... to pin the thread to a cpu list
+			std::cerr << "pin: cannot bind to cpus " << std::string(meta["pin"]) << std::endl;
+		if (meta.find("numa") != meta.end()) // pass numa=... to place the tables (interleave, local, replicate, none)
+			placement = numa::parse(meta["numa"]);
 		if (meta.find("alpha") != meta.end())
 			alpha = float(meta["alpha"]);
+		if (meta.find("value") != meta.end()) // pass value=shared to init the shared afterstate tables, a loaded file keeps its own
+			layout = std::string(meta["value"]) == "shared" ? shared : split;
+		if (meta.find("init") != meta.end() && meta.find("load") == meta.end()) // pass init=... to initialize the weight, unless it is loaded
+			init_weights(meta["init"]);
+		if (meta.find("load") != meta.end() && meta.find("mmap") != meta.end()) // pass mmap=1 to map the file instead
+			map_weights(meta["load"]);
+		else if (meta.find("load") != meta.end()) // pass load=... to load from a specific file
+			load_weights(meta["load"]);
+		origin = episode; // a new run, unless resume() is called
+		if (alpha != 0) for (weight& w : net) w.densify(); // sparse tables are read-only
+		if (placement == numa::replicate) {
+			if (alpha == 0) for (weight& w : net) w.replicate();
+			else std::cerr << "numa: replicate requires alpha=0, tables are kept on first-touch" << std::endl;
+		}
+		if (meta.find("cache") != meta.end()) { // pass cache=... to read through a hot tier of N MB per thread
+			if (alpha == 0) for (weight& w : net) w.cache(double(meta["cache"]) * 1048576 / net.size());
+			else std::cerr << "cache: requires alpha=0, tables are read directly" << std::endl;
+		}
+		if (meta.find("schedule") != meta.end()) { // pass schedule=... to adapt the learning rate (const, step, tc, adam)
+			std::string name = meta["schedule"];
+			schedule = name == "step" ? step : name == "tc" ? tc : name == "adam" ? adam : constant;
+		}
+		if (meta.find("decay") != meta.end()) // pass decay=... to scale the rate of the step schedule
+			decay = float(meta["decay"]);
+		if (meta.find("period") != meta.end()) // pass period=... to decay the rate every N episodes
+			period = std::max(size_t(meta["period"]), size_t(1));
+		if (schedule == tc || schedule == adam) { // two per-entry accumulators for each table
+			for (const weight& w : net) {
+				moment.emplace_back(w.size(), placement);
+				moment.emplace_back(w.size(), placement);
+			}
+			if (meta.find("load") != meta.end()) load_moments(std::string(meta["load"]) + ".moment");
+		}
+		if (meta.find("stats") != meta.end()) // pass stats=... to print the table statistics every N episodes
+			monitor = size_t(meta["stats"]);
+		usage.assign(net.size(), {});
+		rate = learning_rate();
+		if (meta.find("checkpoint") != meta.end()) { // pass checkpoint=... to save snapshots in the background
+			checkpoint = std::string(meta["checkpoint"]);
+			if (meta.find("every") != meta.end()) // pass every=... to snapshot every N episodes
+				every = size_t(meta["every"]);
+			if (meta.find("interval") != meta.end()) // pass interval=... to snapshot every T seconds
+				interval = double(meta["interval"]);
+			if (!every && !interval) every = 1000;
+			snapshot_episode = episode;
+		}
+		if (meta.find("buffer") != meta.end()) // pass buffer=... to batch the updates of every N episodes
+			buffer = size_t(meta["buffer"]);
+		if (buffer && meta.find("updater") != meta.end() && int(meta["updater"])) // pass updater=1 to apply them in the background
+			updater = std::thread(&weight_agent::update_loop, this);
 	}
 	virtual ~weight_agent() {
+		if (updater.joinable()) {
+			drain();
+			{ std::lock_guard<std::mutex> guard(lock); quit = true; }
+			signal.notify_all();
+			updater.join();
+		}
+		apply_pending(pending);
+		if (meta.find("cache") != meta.end() && alpha == 0 && !follower) show_cache();
+		wait_snapshot(true);
+		if (checkpoint.size() && episode != snapshot_episode) { // the episodes since the last snapshot
+			save_snapshot(checkpoint);
+			wait_snapshot(true);
+		}
 		if (meta.find("save") != meta.end()) // pass save=... to save to a specific file
 			save_weights(meta["save"]);
 	}
 
+	virtual void close_episode(const std::string& flag = "") {
+		episode++;
+		if (buffer && ++batched >= buffer) flush(); // counted here, since a follower takes the episode count of its origin
+		rate = learning_rate();
+		if (monitor && episode % monitor == 0 && !follower) drain(), show_usage();
+		if (checkpoint.empty()) return;
+		auto now = std::chrono::steady_clock::now();
+		bool due = (every && episode % every == 0);
+		due |= (interval && std::chrono::duration<double>(now - last_snapshot).count() >= interval);
+		if (due && !snapshot_due) requests++, synced = 0;
+		snapshot_due |= due;
+		if (snapshot_due && synced >= followers && wait_snapshot(false)) { // one due while the last is still written is taken later
+			flush(), drain();
+			save_snapshot(checkpoint);
+			last_snapshot = now;
+			snapshot_episode = episode;
+			snapshot_due = false;
+		}
+	}
+
+	/**
+	 * the number of trained episodes, including those restored from the loaded file
+	 */
+	size_t episodes() const { return episode; }
+
+	/**
+	 * continue the run that wrote the loaded file, e.g., a checkpoint, and return the episodes
+	 * that run had finished; a file without the start of its run counts all its episodes
+	 */
+	size_t resume() {
+		origin = std::min(saved_origin, episode);
+		return episode - origin;
+	}
+
+	/**
+	 * the number of weight tables, 0 if neither init nor load is given
+	 */
+	size_t tables() const { return net.size(); }
+
+	/**
+	 * read and update the tables of another agent instead of owning any, e.g., in the players
+	 * of parallel games; the updates are not synchronized, and the tables must outlive this
+	 *
+	 * such an agent records the usage the origin monitors, but leaves the reports to the origin,
+	 * and the origin takes no snapshot until the updates such an agent buffers are merged
+	 */
+	void share(weight_agent& origin) {
+		net.clear();
+		for (const weight& w : origin.net) net.push_back(weight::view(w));
+		moment.clear();
+		for (const weight& w : origin.moment) moment.push_back(weight::view(w));
+		layout = origin.layout;
+		monitor = origin.monitor;
+		usage.assign(net.size(), {});
+		follower = true;
+		if (buffer) origin.followers++;
+		follow(origin);
+	}
+
+	/**
+	 * add the table usage and the hot tier hits of an agent that shares the tables, and restart
+	 * its count; call it on the thread of that agent, since each thread has its own hot tiers
+	 *
+	 * while a snapshot is due, the buffered updates of that agent are also applied, and the
+	 * snapshot is taken once every agent with a buffer has done so, after each game it counts
+	 */
+	void merge(weight_agent& worker) {
+		if (snapshot_due && worker.buffer) {
+			worker.flush();
+			worker.drain();
+			if (worker.synced_request != requests) worker.synced_request = requests, synced++;
+		}
+		for (size_t t = 0; t < usage.size() && t < worker.usage.size(); t++) {
+			usage[t].updates += worker.usage[t].updates;
+			usage[t].touched += worker.usage[t].touched;
+			usage[t].error += worker.usage[t].error;
+			worker.usage[t] = {};
+		}
+		for (const weight& w : worker.net) {
+			std::pair<size_t, size_t> usage = w.cache_usage(true);
+			cache_hits += usage.first;
+			cache_misses += usage.second;
+		}
+	}
+
+	/**
+	 * take the episode count of another agent, so that the learning rate follows its schedule
+	 */
+	void follow(const weight_agent& origin) {
+		episode = origin.episode;
+		rate = learning_rate();
+	}
+
 protected:
+	static constexpr uint32_t signature = 0x54475754; // "TWGT", without the start of the run
+	static constexpr uint32_t run_signature = 0x52475754; // "TWGR"
+	static constexpr uint32_t sparse_signature = 0x50535754; // "TWSP", tables in the blocked sparse layout
+
+	/**
+	 * a weight file that cannot be loaded, thrown instead of ending the process, e.g., of a library caller
+	 */
+	struct load_error : std::runtime_error {
+		load_error(const std::string& message) : std::runtime_error(message) {}
+	};
+
+	struct header {
+		uint32_t magic;
+		uint16_t size;
+		uint16_t layout; // zero in the files written before the layouts existed
+		uint64_t episode;
+		uint64_t origin; // the trained episodes when the run started, only after run_signature
+	};
+	static size_t header_size(uint32_t magic) {
+		return magic == run_signature ? sizeof(header) : offsetof(header, origin);
+	}
+
 	virtual void init_weights(const std::string& info) {
-		net.emplace_back(0xFFFFFFF * 4); // create an empty weight table with size 65536
-		net.emplace_back(0xFFFFFFF * 4);
-		net.emplace_back(0xFFFFFFF * 4);
-		net.emplace_back(0xFFFFFFF * 4);
+		if (layout == shared) {
+			for (int i = 0; i < 4; i++) net.emplace_back(1 << 24, placement); // one entry per tuple pattern
+			for (int i = 0; i < 4; i++) net.emplace_back(1 << 18, placement); // (op, hint) corrections on the leading 3 cells
+			return;
+		}
+		net.emplace_back(0xFFFFFFF * 4, placement); // create an empty weight table with size 65536
+		net.emplace_back(0xFFFFFFF * 4, placement);
+		net.emplace_back(0xFFFFFFF * 4, placement);
+		net.emplace_back(0xFFFFFFF * 4, placement);
 	}
+	/**
+	 * read the tables with one thread per table, into pages that are only allocated here;
+	 * the header and the table lengths are checked against the file size before that
+	 */
 	virtual void load_weights(const std::string& path) {
-		std::ifstream in(path, std::ios::in | std::ios::binary);
-		if (!in.is_open()) std::exit(-1);
-		uint32_t size;
-		in.read(reinterpret_cast<char*>(&size), sizeof(size));
-		net.resize(size);
-		for (weight& w : net) in >> w;
-		in.close();
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) throw load_error("load: cannot open " + path);
+		header head;
+		off_t offset = read_header(fd, head);
+		if (offset && head.magic == sparse_signature) {
+			::close(fd);
+			map_weights(path);
+			return;
+		}
+		std::vector<std::pair<off_t, uint64_t>> tables;
+		if (!offset || !locate_tables(fd, head, offset, tables)) {
+			::close(fd);
+			throw load_error("load: " + path + " is not a valid weight file");
+		}
+		episode = head.episode;
+		saved_origin = head.origin;
+		layout = value_layout(head.layout);
+		net.clear();
+		for (const auto& table : tables) net.emplace_back(table.second, placement);
+		std::atomic<bool> failed(false);
+		std::vector<std::thread> readers;
+		for (size_t i = 0; i < net.size(); i++) {
+			readers.emplace_back([&, i]() {
+				if (!read_fully(fd, net[i].data(), sizeof(float) * tables[i].second, tables[i].first)) failed = true;
+			});
+		}
+		for (std::thread& reader : readers) reader.join();
+		::close(fd);
+		if (failed) throw load_error("load: failed to read " + path);
+	}
+	/**
+	 * map the tables straight from the file, pages are faulted in on first use
+	 * this is also how the files with sparse tables are loaded
+	 */
+	virtual void map_weights(const std::string& path) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) throw load_error("load: cannot open " + path);
+		header head;
+		off_t offset = read_header(fd, head);
+		std::vector<std::pair<off_t, uint64_t>> tables;
+		if (!offset || (head.magic != sparse_signature && !locate_tables(fd, head, offset, tables))) {
+			::close(fd);
+			throw load_error("load: " + path + " is not a valid weight file");
+		}
+		episode = head.episode;
+		saved_origin = head.origin;
+		layout = value_layout(head.layout);
+		net.clear();
+		net.resize(head.size, weight(placement));
+		for (size_t i = 0; i < net.size(); i++) {
+			bool attached = true;
+			if (head.magic == sparse_signature) {
+				size_t size = net[i].attach_sparse(fd, offset);
+				attached = size != 0;
+				offset += size;
+			} else {
+				attached = net[i].attach(fd, tables[i].first, tables[i].second);
+			}
+			if (!attached) {
+				::close(fd);
+				net.clear();
+				throw load_error("load: " + path + " is not a valid weight file");
+			}
+		}
+		::close(fd);
+	}
+
+	/**
+	 * read the header of a weight file, and return the offset of the first table (0 on failure)
+	 */
+	static off_t read_header(int fd, header& head) {
+		head = { 0, 0, 0, 0, 0 };
+		if (::pread(fd, &head.magic, sizeof(head.magic), 0) != sizeof(head.magic)) return 0;
+		if (head.magic != signature && head.magic != run_signature && head.magic != sparse_signature) {
+			head.size = head.magic; // legacy file, the table count comes first
+			return sizeof(head.magic);
+		}
+		size_t size = header_size(head.magic);
+		if (::pread(fd, &head, size, 0) != ssize_t(size)) return 0;
+		return head.layout <= shared ? size : 0;
+	}
+	/**
+	 * find the offset and the length of each dense table, false if a table ends past the file
+	 */
+	static bool locate_tables(int fd, const header& head, off_t offset, std::vector<std::pair<off_t, uint64_t>>& tables) {
+		struct stat info;
+		if (::fstat(fd, &info) != 0) return false;
+		tables.clear();
+		for (size_t i = 0; i < head.size; i++) {
+			uint64_t length = 0;
+			if (::pread(fd, &length, sizeof(length), offset) != sizeof(length)) return false;
+			offset += sizeof(length);
+			if (length > uint64_t(info.st_size - offset) / sizeof(float)) return false;
+			tables.emplace_back(offset, length);
+			offset += sizeof(float) * length;
+		}
+		return true;
 	}
 	virtual void save_weights(const std::string& path) {
 		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
 		if (!out.is_open()) std::exit(-1);
-		uint32_t size = net.size();
-		out.write(reinterpret_cast<char*>(&size), sizeof(size));
-		for (weight& w : net) out << w;
+		bool sparse = meta.find("format") != meta.end() && std::string(meta["format"]) == "sparse"; // pass format=sparse to save sparse tables
+		header head = { sparse ? sparse_signature : run_signature, uint16_t(net.size()), uint16_t(layout), episode, origin };
+		out.write(reinterpret_cast<char*>(&head), header_size(head.magic));
+		for (weight& w : net) {
+			if (sparse) w.write_sparse(out, 256, meta.find("prune") != meta.end() ? float(meta["prune"]) : 0); // pass prune=... to drop |w| <= eps
+			else out << w;
+		}
+		out.close();
+		if (moment.size()) save_moments(path + ".moment");
+	}
+
+	/**
+	 * the accumulators of the tc and adam schedules are kept next to the weights, in a weight file
+	 * with two tables for each weight table, since the adapted rates restart without them
+	 */
+	void save_moments(const std::string& path) {
+		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) std::exit(-1);
+		header head = { run_signature, uint16_t(moment.size()), uint16_t(layout), episode, origin };
+		out.write(reinterpret_cast<char*>(&head), sizeof(head));
+		for (const weight& m : moment) out << m;
 		out.close();
 	}
+	/**
+	 * load the accumulators saved with the loaded weights, they are kept at zero if there are none,
+	 * or if they do not belong to the same tables and episodes
+	 */
+	void load_moments(const std::string& path) {
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		if (!in.is_open()) return;
+		header head;
+		in.read(reinterpret_cast<char*>(&head), sizeof(head));
+		bool matched = in && head.magic == run_signature && head.size == moment.size() && head.episode == episode;
+		for (size_t i = 0; matched && i < moment.size(); i++) {
+			uint64_t size = 0;
+			matched = in.read(reinterpret_cast<char*>(&size), sizeof(size)) && size == moment[i].size();
+			matched = matched && in.read(reinterpret_cast<char*>(moment[i].data()), sizeof(float) * size);
+		}
+		if (matched) return;
+		for (weight& m : moment) std::fill(m.data(), m.data() + m.size(), 0.0f);
+		std::cerr << "schedule: " << path << " does not match the loaded weights, the accumulators restart" << std::endl;
+	}
+
+	/**
+	 * fork a child to write the weights, the copy-on-write address space of the child
+	 * keeps the snapshot consistent while the parent continues training
+	 *
+	 * the child only issues raw system calls, and each file is renamed into place
+	 * after it is completely written, so a crash never leaves a torn checkpoint;
+	 * the accumulators of the schedule, if any, are written before the weights
+	 */
+	virtual void save_snapshot(const std::string& path) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			bool done = moment.empty() || write_tables(path + ".moment", moment);
+			done = done && write_tables(path, net);
+			_exit(done ? 0 : 1);
+		} else if (pid > 0) {
+			snapshot = pid;
+		} else {
+			std::cerr << "checkpoint: fork failed at episode " << episode << std::endl;
+		}
+	}
+
+	bool write_tables(const std::string& path, const std::vector<weight>& tables) const {
+		std::string temp = path + ".tmp";
+		int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		bool done = (fd >= 0);
+		header head = { run_signature, uint16_t(tables.size()), uint16_t(layout), episode, origin };
+		done = done && write_fully(fd, &head, sizeof(head));
+		for (const weight& w : tables) {
+			uint64_t size = w.size();
+			done = done && write_fully(fd, &size, sizeof(size));
+			done = done && write_fully(fd, w.data(), sizeof(float) * size);
+		}
+		done = done && ::fsync(fd) == 0;
+		done = (fd >= 0 && ::close(fd) == 0) && done;
+		return done && ::rename(temp.c_str(), path.c_str()) == 0;
+	}
+
+	/**
+	 * reap the pending snapshot, return false if it is still being written
+	 */
+	bool wait_snapshot(bool block) {
+		if (snapshot <= 0) return true;
+		int status = 0;
+		pid_t pid = waitpid(snapshot, &status, block ? 0 : WNOHANG);
+		if (pid == 0) return false;
+		if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			std::cerr << "checkpoint: failed to write " << checkpoint << std::endl;
+		else
+			metrics::instance().checkpoint();
+		snapshot = 0;
+		return true;
+	}
+
+	/**
+	 * the learning rate at the current episode, the step schedule decays by
+	 * the trained episodes, which are restored with the weights
+	 */
+	float learning_rate() const {
+		if (schedule != step) return alpha;
+		return alpha * std::pow(decay, double(episode / period));
+	}
+
+	/**
+	 * apply a TD error to an entry now, or queue it if the updates are batched
+	 */
+	void learn(size_t table, size_t i, double error, double share) {
+		if (buffer) pending.push_back({ (uint64_t(table) << 32) | i, float(error), float(share) });
+		else apply(table, i, error, share);
+	}
+
+	/**
+	 * apply a TD error to an entry, where the error is shared by 'share' entries
+	 *
+	 * const/step: w += rate * error / share
+	 * tc:         w += rate * |E| / A * error / share, with E = sum of errors and A = sum of |errors|
+	 * adam:       w += rate * m / (sqrt(v) + eps), with the moving moments of error / share
+	 */
+	void apply(size_t table, size_t i, double error, double share) {
+		float& w = net[table][i];
+		bool zero = (w == 0);
+		switch (schedule) {
+		default:
+			w += error * rate / share;
+			break;
+		case tc: {
+			float& e = moment[table * 2][i];
+			float& a = moment[table * 2 + 1][i];
+			double coherence = a ? std::abs(e) / a : 1.0;
+			w += error * rate * coherence / share;
+			e += error;
+			a += std::abs(error);
+			break;
+		}
+		case adam: {
+			float& m = moment[table * 2][i];
+			float& v = moment[table * 2 + 1][i];
+			double g = error / share;
+			m = 0.9 * m + 0.1 * g;
+			v = 0.999 * v + 0.001 * g * g;
+			w += rate * m / (std::sqrt(v) + 1e-8);
+			break;
+		}
+		}
+		if (monitor) {
+			table_usage& u = usage[table];
+			u.updates++;
+			u.touched += zero && w != 0;
+			u.error += std::abs(error);
+		}
+	}
+
+	/**
+	 * the queued updates, sorted by table and entry so that the tables are written in
+	 * one ascending sweep, and the errors queued for the same entry are summed first
+	 */
+	struct delta {
+		uint64_t key; // the table in the high half, the entry in the low half
+		float error;
+		float share;
+	};
+
+	void apply_pending(std::vector<delta>& list) {
+		std::sort(list.begin(), list.end(), [](const delta& a, const delta& b) { return a.key < b.key; });
+		for (size_t i = 0; i < list.size(); ) {
+			delta d = list[i];
+			for (i++; i < list.size() && list[i].key == d.key; i++) d.error += list[i].error;
+			apply(d.key >> 32, d.key & 0xFFFFFFFFu, d.error, d.share);
+		}
+		list.clear();
+	}
+
+	/**
+	 * apply the queued updates, or hand them to the updater thread once it is idle
+	 */
+	void flush() {
+		batched = 0;
+		if (!updater.joinable()) {
+			apply_pending(pending);
+			return;
+		}
+		std::unique_lock<std::mutex> guard(lock);
+		signal.wait(guard, [this]() { return !busy; });
+		std::swap(pending, handoff);
+		busy = true;
+		signal.notify_all();
+	}
+
+	/**
+	 * wait until the updater thread has applied what it was given
+	 */
+	void drain() {
+		if (!updater.joinable()) return;
+		std::unique_lock<std::mutex> guard(lock);
+		signal.wait(guard, [this]() { return !busy; });
+	}
+
+	void update_loop() {
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			signal.wait(guard, [this]() { return busy || quit; });
+			if (!busy) return;
+			guard.unlock();
+			apply_pending(handoff);
+			guard.lock();
+			busy = false;
+			signal.notify_all();
+		}
+	}
+
+	/**
+	 * print the hit rate of the hot tiers of this thread
+	 */
+	void show_cache() const {
+		size_t hits = cache_hits, misses = cache_misses;
+		for (const weight& w : net) {
+			std::pair<size_t, size_t> usage = w.cache_usage();
+			hits += usage.first;
+			misses += usage.second;
+		}
+		std::cout << "cache: hits = " << hits << ", misses = " << misses;
+		std::cout << ", hit rate = " << (hits + misses ? hits * 100.0 / (hits + misses) : 0) << "%" << std::endl;
+	}
+
+	/**
+	 * print the per-table usage since the last report
+	 *
+	 * 'touched': the fraction of entries that left zero during this run
+	 * '|td|': the mean absolute TD error of the updates
+	 * 'updates': the updates per episode
+	 * 'resident': the memory taken by the pages touched so far
+	 */
+	void show_usage() {
+		std::ios ff(nullptr);
+		ff.copyfmt(std::cout);
+		std::cout << episode << "\t" << "rate = " << rate << std::endl;
+		for (size_t t = 0; t < usage.size(); t++) {
+			table_usage& u = usage[t];
+			std::cout << "\t" "table " << t << ": ";
+			std::cout << "touched = " << std::setprecision(3) << (u.touched * 100.0 / std::max<size_t>(net[t].size(), 1)) << "%, ";
+			std::cout << "|td| = " << (u.updates ? u.error / u.updates : 0) << ", ";
+			std::cout << "updates = " << std::fixed << std::setprecision(1) << (u.updates / double(monitor)) << "/episode, ";
+			std::cout << "resident = " << (net[t].resident() / 1048576.0) << "MB";
+			std::cout << std::defaultfloat << std::endl;
+			u.updates = 0;
+			u.error = 0;
+		}
+		std::cout.copyfmt(ff);
+	}
+
+	static bool read_fully(int fd, void* buf, size_t len, off_t offset) {
+		char* ptr = static_cast<char*>(buf);
+		while (len) {
+			ssize_t n = ::pread(fd, ptr, std::min(len, size_t(1) << 30), offset);
+			if (n <= 0) return false;
+			ptr += n, len -= n, offset += n;
+		}
+		return true;
+	}
+	static bool write_fully(int fd, const void* buf, size_t len) {
+		const char* ptr = static_cast<const char*>(buf);
+		while (len) {
+			ssize_t n = ::write(fd, ptr, std::min(len, size_t(1) << 30));
+			if (n <= 0) return false;
+			ptr += n, len -= n;
+		}
+		return true;
+	}
 
 protected:
+	enum schedule_t { constant, step, tc, adam };
+
+	/**
+	 * how the player maps a feature, the slide, and the hint to the entries
+	 * split: one entry per (pattern, op, hint), i.e., 64 independent sub-tables
+	 * shared: one entry per pattern shared by all (op, hint), plus a small correction
+	 *         per (op, hint) indexed by the leading 3 cells of the pattern
+	 */
+	enum value_layout : uint16_t { split, shared };
+
+	struct table_usage {
+		size_t updates;
+		size_t touched;
+		double error;
+	};
+
 	std::vector<weight> net;
 	float alpha;
+	numa::policy placement;
+	value_layout layout;
+
+	schedule_t schedule;
+	float rate;
+	float decay;
+	size_t period;
+	std::vector<weight> moment;
+	size_t monitor;
+	std::vector<table_usage> usage;
+	size_t cache_hits;   // those of the agents merged into this one
+	size_t cache_misses;
+	bool follower;       // whether the tables are shared from another agent
+
+	uint64_t episode;
+	uint64_t origin;       // the trained episodes when this run started
+	uint64_t saved_origin; // the same of the run that wrote the loaded file
+	std::string checkpoint;
+	size_t every;
+	double interval;
+	pid_t snapshot;
+	std::chrono::steady_clock::time_point last_snapshot;
+	uint64_t snapshot_episode; // the episodes in the last snapshot
+	bool snapshot_due;
+	uint64_t requests;       // the snapshots that came due
+	size_t followers;        // the agents with a buffer that share the tables
+	size_t synced;           // those that applied their buffer since the last snapshot came due
+	uint64_t synced_request; // the last due snapshot this agent applied its buffer for
+
+	size_t buffer;
+	size_t batched; // the episodes in the buffer
+	std::vector<delta> pending;
+	std::vector<delta> handoff;
+	std::thread updater;
+	std::mutex lock;
+	std::condition_variable signal;
+	bool busy;
+	bool quit;
 };
 
 /**
@@ -126,6 +779,13 @@ protected:
 	float alpha;
 };
 
+/**
+ * TD(0) afterstate player with 8 x 4 six-tuple features
+ *
+ * the 24-bit cell part of each tuple index is kept in a feature vector, which is
+ * maintained incrementally by only revisiting the tuples that cover changed cells
+ * pass incremental=0 to recompute every feature from scratch instead
+ */
 class player : public weight_agent {
 public:
 	player(const std::string& args = "") : weight_agent("name=weight role=player " + args),
@@ -137,152 +797,427 @@ public:
 		{{{3,2,1,0,7,6},{7,6,5,4,11,10},{4,5,6,8,9,10},{12,13,14,8,9,10}}},
 		{{{15,11,7,3,14,10},{14,10,6,2,13,9},{2,6,10,1,5,9},{0,4,8,1,5,9}}},
 		{{{12,13,14,15,8,9},{8,9,10,11,4,5},{11,10,9,7,6,5},{3,2,1,7,6,5}}},
-		{{{0,4,8,12,1,5},{1,5,9,13,2,6},{13,9,5,14,10,6},{15,11,7,14,10,6}}}}}) {}
+		{{{0,4,8,12,1,5},{1,5,9,13,2,6},{13,9,5,14,10,6},{15,11,7,14,10,6}}}}}),
+		incremental(true), last_feature(), danger(0), depth(2), budget(0), critical_moves(0), searched_moves(0), searched_depth(0) {
+		if (meta.find("incremental") != meta.end())
+			incremental = int(meta["incremental"]);
+		if (meta.find("danger") != meta.end()) // pass danger=... to search deeper when empty cells + mergeable pairs <= N
+			danger = unsigned(meta["danger"]);
+		if (meta.find("depth") != meta.end()) // pass depth=... to limit the deeper search to N slides
+			depth = std::max(unsigned(meta["depth"]), 1u);
+		if (meta.find("budget") != meta.end()) // pass budget=... to limit the deeper search to T milliseconds per move
+			budget = double(meta["budget"]);
+		if (meta.find("dump") != meta.end()) // pass dump=... to append the trajectories to a corpus
+			dump.reset(new corpus::writer(meta["dump"]));
+		for (int i = 0; i < 8; i++) {
+			for (int j = 0; j < 4; j++) {
+				for (int k = 0; k < 6; k++) {
+					taps[tuples[i][j][k]].push_back({ i * 4 + j, 4 * (5 - k) });
+				}
+			}
+		}
+	}
 
 	virtual action take_action(const board& before, int& hint) {
 
-		board after;
-		unsigned int hash;
-		int reward, final_reward = 0;
-		int final_op = -1; 
-		double value, highest_value = -2147483648;
+		// the previous afterstate differs from this state only by the placed tile
+		feature current = last_feature;
+		if (incremental) update(last_board, before, current);
+		else extract(before, current);
 
-		for (int op : opcode) { // four direction
-			after = board(before);
-			reward = after.slide(op);
-			if (reward != -1) {
-				// hash the tuple
-				value = reward;
-				for(int i = 0; i < 8; i++){
-					for(int j = 0; j < 4; j++){
-						hash = 0;
-						for(int k = 0; k < 6; k++){
-							hash = (hash << 4) + after(tuples[i][j][k]);
-						}
-						hash = (hash << 6) + (op << 4) + hint;
-						value += net[j][hash];
-					}
+		choice best = select(before, hint, current);
+		if (best.op != -1 && danger && critical(before)) {
+			int op = deepen(before, hint, best.op);
+			if (op != best.op) best = pick(before, hint, current, op);
+		}
+		if (best.op != -1) {
+			last_board = best.after;
+			last_feature = best.indices;
+			board_records.push_back(best.after);
+			feature_records.push_back(best.indices);
+			reward_records.push_back(best.reward);
+			hint_records.push_back(hint);
+			move_records.push_back(best.op);
+			return action::slide(best.op);
+		}
+
+		return action();
+	}
+
+	/**
+	 * whether a hint from outside is a tile that the tables are indexed by
+	 */
+	static bool valid_hint(uint32_t hint) { return hint < 16; }
+
+	/**
+	 * the greedy choice for a state without touching the trajectory, -1 if no slide is legal
+	 */
+	int best_move(const board& before, int hint, double* value = nullptr, int* reward = nullptr) const {
+		feature current;
+		extract(before, current);
+		choice best = select(before, hint, current);
+		if (value) *value = best.value;
+		if (reward) *reward = best.reward;
+		return best.op;
+	}
+
+	/**
+	 * the greedy values (0 if no slide is legal) and slides (-1) of many states at once,
+	 * without touching the trajectory; the afterstates of a chunk are extracted first and
+	 * their entries prefetched, so the scattered table reads overlap instead of stalling in turn
+	 */
+	void evaluate(const board* states, const int* hints, float* values, int* moves, size_t n) const {
+		static constexpr size_t chunk = 16;
+		struct candidate {
+			feature indices;
+			int reward;
+		};
+		candidate batch[chunk][4];
+		for (size_t first = 0; first < n; first += chunk) {
+			size_t size = std::min(chunk, n - first);
+			for (size_t i = 0; i < size; i++) {
+				for (int op = 0; op < 4; op++) {
+					board after = states[first + i];
+					candidate& c = batch[i][op];
+					c.reward = after.slide(op);
+					if (c.reward == -1) continue;
+					extract(after, c.indices);
+					prefetch(c.indices, op, hints[first + i]);
 				}
-				if (highest_value < value) {
-					final_op = op;
-					final_reward = reward;
-					highest_value = value;
+			}
+			for (size_t i = 0; i < size; i++) {
+				int best = -1;
+				double value = 0;
+				for (int op = 0; op < 4; op++) {
+					const candidate& c = batch[i][op];
+					if (c.reward == -1) continue;
+					double v = c.reward + estimate(c.indices, op, hints[first + i]);
+					if (best == -1 || value < v) best = op, value = v;
 				}
+				values[first + i] = value;
+				if (moves) moves[first + i] = best;
 			}
 		}
+	}
 
-		if(final_op != -1){
-			after = board(before);
-			after.slide(final_op);
+	virtual ~player() {
+		if (!danger || follower) return; // the counts of a follower are merged into its origin
+		std::cout << "danger: " << critical_moves << " critical moves, " << searched_moves << " searched deeper";
+		std::cout << ", depth = " << (searched_moves ? double(searched_depth) / searched_moves : 0) << std::endl;
+	}
+
+	/**
+	 * whether a state is critical, i.e., there is a choice of slides, and the empty cells
+	 * and the mergeable pairs, which are the room left to recover from a bad slide, are few
+	 */
+	bool critical(const board& before) const {
+		unsigned legal = before.legal_moves();
+		if (!(legal & (legal - 1))) return false; // at most one slide, nothing to choose
+		return unsigned(__builtin_popcount(before.empty_mask())) + before.mergeable_pairs() <= danger;
+	}
+
+	/**
+	 * add the counts of a player that shares the tables, see weight_agent::merge
+	 */
+	void merge(player& worker) {
+		weight_agent::merge(worker);
+		critical_moves += worker.critical_moves;
+		searched_moves += worker.searched_moves;
+		searched_depth += worker.searched_depth;
+		worker.critical_moves = worker.searched_moves = worker.searched_depth = 0;
+	}
+
+	void backward_train() {
+		if (dump) dump_trajectory();
+		if (alpha != 0) train_trajectory();
+		else clear_records(); // nothing to learn, and sparse tables cannot be written
+	}
+
+	/**
+	 * train on a trajectory from a corpus instead of the one just played
+	 */
+	void replay_train(const corpus::step* steps, size_t size) {
+		if (size == 0) return;
+		feature f;
+		for (size_t i = 0; i < size; i++) {
+			board after = board::unpack(steps[i].after);
+			extract(after, f);
 			board_records.push_back(after);
-			reward_records.push_back(final_reward);
-			hint_records.push_back(hint);
-			move_records.push_back(final_op);
-			return action::slide(final_op);
+			feature_records.push_back(f);
+			reward_records.push_back(steps[i].reward);
+			hint_records.push_back(steps[i].hint);
+			move_records.push_back(steps[i].move);
 		}
+		train_trajectory();
+	}
 
-		return action();
+protected:
+	void dump_trajectory() {
+		std::vector<corpus::step> steps(board_records.size());
+		for (size_t i = 0; i < steps.size(); i++) {
+			steps[i].after = board_records[i].pack();
+			steps[i].reward = reward_records[i];
+			steps[i].hint = hint_records[i];
+			steps[i].move = move_records[i];
+			steps[i].reserved = 0;
+		}
+		dump->write(steps);
 	}
 
-	void backward_train() {
-		unsigned int hash;
+	void train_trajectory() {
 		int pre_move, cur_move, pre_hint, cur_hint;
-		board pre_board, cur_board;
+		feature pre_feature, cur_feature;
 		double pre_value, cur_value, result;
 
 		//update end board
-		pre_board = board_records.back();
+		pre_feature = feature_records.back();
 		pre_move = move_records.back();
 		pre_hint = hint_records.back();
-		board_records.pop_back();
-		move_records.pop_back();
-		hint_records.pop_back();
-		pre_value = 0;
-		for(int i = 0; i < 8; i++){
-			for(int j = 0; j < 4; j++){
-				hash = 0;
-				for(int k = 0; k < 6; k++){
-					hash = (hash << 4) + pre_board(tuples[i][j][k]);
-				}
-				hash = (hash << 6) + (pre_move << 4) + pre_hint;
-				pre_value += net[j][hash];
-			}
-		}
-		result = (0 - pre_value) * alpha / 192;
-		for(int i = 0; i < 8; i++){
-			for(int j = 0; j < 4; j++){
-				hash = 0;
-				for(int k = 0; k < 6; k++){
-					hash = (hash << 4) + pre_board(tuples[i][j][k]);
-				}
-				hash = (hash << 6) + (pre_move << 4) + pre_hint;
-				net[j][hash] += result;
-			}
-		}
+		pop_record();
+		pre_value = estimate(pre_feature, pre_move, pre_hint);
+		result = (0 - pre_value);
+		adjust(pre_feature, pre_move, pre_hint, result);
+		double error = std::abs(result);
+		size_t steps = 1;
 
 		//start backward train
-		while (board_records.size() > 1) {
-			cur_board = pre_board;
+		while (feature_records.size() > 1) {
+			cur_feature = pre_feature;
 			cur_move = pre_move;
 			cur_hint = pre_hint;
-			pre_board = board_records.back();
+			pre_feature = feature_records.back();
 			pre_move = move_records.back();
 			pre_hint = hint_records.back();
-			board_records.pop_back();
-			move_records.pop_back();
-			hint_records.pop_back();
-
-			cur_value = 0;
-			pre_value = 0;
-			for(int i = 0; i < 8; i++){
-				for(int j = 0; j < 4; j++){
-					hash = 0;
-					for(int k = 0; k < 6; k++){
-						hash = (hash << 4) + cur_board(tuples[i][j][k]);
-					}
-					hash = (hash << 6) + (cur_move << 4) + cur_hint;
-					cur_value += net[j][hash];
-				}
-				for(int j = 0; j < 4; j++){
-					hash = 0;
-					for(int k = 0; k < 6; k++){
-						hash = (hash << 4) + pre_board(tuples[i][j][k]);
-					}
-					hash = (hash << 6) + (pre_move << 4) + pre_hint;
-					pre_value += net[j][hash];
-				}
-			}
+			pop_record();
+
+			cur_value = estimate(cur_feature, cur_move, cur_hint);
+			pre_value = estimate(pre_feature, pre_move, pre_hint);
 
 			cur_value += reward_records.back();
 			reward_records.pop_back();
 
-			result = (cur_value - pre_value) * alpha / 192;
-
-			for(int i = 0; i < 8; i++){
-				for(int j = 0; j < 4; j++){
-					hash = 0;
-					for(int k = 0; k < 6; k++){
-						hash = (hash << 4) + pre_board(tuples[i][j][k]);
-					}
-					hash = (hash << 6) + (pre_move << 4) + pre_hint;
-					net[j][hash] += result;
-				}
-			}
+			result = (cur_value - pre_value);
+			adjust(pre_feature, pre_move, pre_hint, result);
+			error += std::abs(result);
+			steps++;
 		}
 
+		metrics::instance().td(error, steps);
+		clear_records();
+	}
+
+	void clear_records() {
 		reward_records.clear();
 		board_records.clear();
+		feature_records.clear();
 		hint_records.clear();
 		move_records.clear();
+		last_board = board();
+		last_feature = feature();
+	}
+
+protected:
+	/**
+	 * the 24-bit cell part of the index of tuple j of isomorphism i, stored at [i * 4 + j]
+	 */
+	typedef std::array<uint32_t, 32> feature;
+
+	void extract(const board& b, feature& f) const {
+		for (int i = 0; i < 8; i++) {
+			for (int j = 0; j < 4; j++) {
+				uint32_t index = 0;
+				for (int k = 0; k < 6; k++) {
+					index = (index << 4) + b(tuples[i][j][k]);
+				}
+				f[i * 4 + j] = index;
+			}
+		}
+	}
+
+	/**
+	 * turn the feature of board 'from' into the feature of board 'to'
+	 */
+	void update(const board& from, const board& to, feature& f) const {
+		for (int pos = 0; pos < 16; pos++) {
+			uint32_t diff = from(pos) ^ to(pos);
+			if (diff == 0) continue;
+			for (const tap& t : taps[pos]) f[t.slot] ^= diff << t.shift;
+		}
+	}
+
+	struct choice {
+		int op;
+		int reward;
+		double value;
+		board after;
+		feature indices;
+	};
+
+	/**
+	 * evaluate the four slides of a state whose feature is given
+	 */
+	choice select(const board& before, int hint, const feature& current) const {
+		choice best = { -1, 0, -2147483648.0, before, current };
+		unsigned legal = before.legal_moves();
+		for (int op : opcode) { // four direction
+			if (!(legal & (1u << op))) continue;
+			board after = board(before);
+			int reward = after.slide(op);
+			if (reward != -1) {
+				feature cand = current;
+				if (incremental) update(before, after, cand);
+				else extract(after, cand);
+				double value = reward + estimate(cand, op, hint);
+				if (best.value < value) best = { op, reward, value, after, cand };
+			}
+		}
+		return best;
+	}
+
+	/**
+	 * the choice of a given slide, which must be legal
+	 */
+	choice pick(const board& before, int hint, const feature& current, int op) const {
+		board after = board(before);
+		int reward = after.slide(op);
+		feature cand = current;
+		if (incremental) update(before, after, cand);
+		else extract(after, cand);
+		return { op, reward, reward + estimate(cand, op, hint), after, cand };
+	}
+
+	typedef std::chrono::steady_clock clock;
+
+	/**
+	 * the slide chosen by an expectimax search, deepened one slide at a time from the greedy
+	 * choice; the choice of the deepest search finished within the budget is kept
+	 */
+	int deepen(const board& before, int hint, int greedy) {
+		clock::time_point deadline = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::milli>(budget));
+		int best = greedy;
+		unsigned reached = 1;
+		for (unsigned d = 2; d <= depth; d++) {
+			bool finished = true;
+			double value = 0;
+			int op = search(before, hint, d, deadline, finished, value);
+			if (!finished) break;
+			best = op;
+			reached = d;
+		}
+		critical_moves++;
+		if (reached > 1) searched_moves++, searched_depth += reached;
+		return best;
+	}
+
+	/**
+	 * the best slide of a state and its value, searched to the given depth in slides
+	 * after a slide, the known tile lands on any empty cell of the opposite edge with equal
+	 * probability, and the next tile is taken as 1, 2, or 3 with equal probability
+	 */
+	int search(const board& before, int hint, unsigned depth, clock::time_point deadline, bool& finished, double& value) const {
+		static constexpr unsigned edge[4] = { 0xF000, 0x1111, 0x000F, 0x8888 }; // opposite to U, R, D, L
+		int best = -1;
+		value = 0;
+		for (int op = 0; op < 4; op++) {
+			board after = board(before);
+			int reward = after.slide(op);
+			if (reward == -1) continue;
+			double v = reward;
+			if (depth == 1) {
+				feature f;
+				extract(after, f);
+				v += estimate(f, op, hint);
+			} else {
+				if (budget && clock::now() >= deadline) return finished = false, -1;
+				double sum = 0;
+				unsigned count = 0;
+				for (unsigned cells = after.empty_mask() & edge[op]; cells; cells &= cells - 1) {
+					board next = board(after);
+					next.place(__builtin_ctz(cells), hint);
+					for (int tile = 1; tile <= 3; tile++, count++) {
+						double expect = 0;
+						search(next, tile, depth - 1, deadline, finished, expect); // 0 if the game ends
+						if (!finished) return -1;
+						sum += expect;
+					}
+				}
+				v += count ? sum / count : 0;
+			}
+			if (best == -1 || value < v) best = op, value = v;
+		}
+		return best;
+	}
+
+	uint32_t index(uint32_t f, int op, int hint) const {
+		return (f << 6) + (op << 4) + hint;
+	}
+	uint32_t correction(uint32_t f, int op, int hint) const {
+		return index(f >> 12, op, hint);
+	}
+
+	double estimate(const feature& f, int op, int hint) const {
+		double value = 0;
+		if (layout == shared) {
+			for (int s = 0; s < 32; s++) value += net[s % 4][f[s]] + net[4 + s % 4][correction(f[s], op, hint)];
+			return value;
+		}
+		for (int s = 0; s < 32; s++) value += net[s % 4][index(f[s], op, hint)];
+		return value;
+	}
+
+	void prefetch(const feature& f, int op, int hint) const {
+		for (int s = 0; s < 32; s++) {
+			if (layout == shared) {
+				net[s % 4].prefetch(f[s]);
+				net[4 + s % 4].prefetch(correction(f[s], op, hint));
+			} else {
+				net[s % 4].prefetch(index(f[s], op, hint));
+			}
+		}
+	}
+
+	void adjust(const feature& f, int op, int hint, double error) {
+		if (layout == shared) { // twice the entries take the same step together
+			for (int s = 0; s < 32; s++) {
+				learn(s % 4, f[s], error, 384);
+				learn(4 + s % 4, correction(f[s], op, hint), error, 384);
+			}
+			return;
+		}
+		for (int s = 0; s < 32; s++) learn(s % 4, index(f[s], op, hint), error, 192);
+	}
+
+	void pop_record() {
+		board_records.pop_back();
+		feature_records.pop_back();
+		move_records.pop_back();
+		hint_records.pop_back();
 	}
 
 private:
+	struct tap {
+		int slot;
+		int shift;
+	};
+
 	std::array<int, 4> opcode;
 	std::vector<int> reward_records;
 	std::vector<board> board_records;
+	std::vector<feature> feature_records;
 	std::vector<int> hint_records;
 	std::vector<int> move_records;
 	std::array<std::array<std::array<int, 6>, 4>, 8> tuples;
+	std::array<std::vector<tap>, 16> taps;
+	bool incremental;
+	board last_board;
+	feature last_feature;
+	std::unique_ptr<corpus::writer> dump;
+	unsigned danger;
+	unsigned depth;
+	double budget;
+	size_t critical_moves;
+	size_t searched_moves;
+	size_t searched_depth;
 };
 /**
  * random environment
@@ -319,9 +1254,10 @@ public:
 
 		std::shuffle(data, data+length, engine);
 		int pos, max;
+		unsigned empty = after.empty_mask();
 		for (int i = 0; i < length; i++) {
 			pos = data[i];
-			if (after(pos) == 0) {
+			if (empty & (1u << pos)) {
 				uint32_t tmp = next;
 				max = after.max_cell();
 				if (max >= 7 && create_random_number() <= (1.0f / 21.0f)) {
@@ -336,6 +1272,18 @@ public:
 		return action();
 	}
 
+	virtual void open_episode(const std::string& flag = "") {
+		random_agent::open_episode(flag);
+		if (seeded) { // start each game from the same state
+			std::iota(space.begin(), space.end(), 0);
+			left_edge = {{ 0, 4, 8, 12 }};
+			right_edge = {{ 3, 7, 11, 15 }};
+			up_edge = {{ 0, 1, 2, 3 }};
+			down_edge = {{ 12, 13, 14, 15 }};
+			reset_bag();
+		}
+	}
+
 	void reset_bag(){
 		bag.clear();
 		next = get_tile_from_bag();
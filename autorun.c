@@ -17,18 +17,19 @@ int main(int argc, char **argv) {
 	srand(time(NULL));
 
 	char *line;
-	char oper[] = "./Three --total=100000 --block=10000 --play=load=weights.bin save=weights.bin alpha=0.1"; //--evil=seed=";
+	char oper[] = "./Three --total=100000 --block=10000 --metrics=three.prom --play=\"load=weights.bin save=weights.bin alpha=0.1 schedule=step decay=0.5 period=1000000\"";
 	char *seed;
     char **args;
     int status;
 
 	do {
-		line = malloc(100 * sizeof(char));
-		seed = malloc(5 * sizeof(char));
+		seed = malloc(16 * sizeof(char));
 		s = (rand() % (9999-1000+1)) + 1000;
-		sprintf(seed, "%d", s);
+		sprintf(seed, " --seed=%d", s); // each run can be replayed from the seed in its command line
+		line = malloc((strlen(oper) + strlen(seed) + 1) * sizeof(char));
+		line[0] = '\0';
 		strcat(line, oper);
-		//strcat(line, seed);
+		strcat(line, seed);
 
 		args = split_line(line);
         status = execute(args);
@@ -44,23 +45,34 @@ int main(int argc, char **argv) {
 	return 0;
 }
 
+/**
+ * split a line on blanks like a shell, except that blanks between double quotes are kept
+ * and the quotes are dropped, e.g., --play="load=a save=b" is one argument --play=load=a save=b
+ */
 char **split_line(char *line) {
 
     char* delim = " \n\t\a";
     int position = 0;
     char **tokens = malloc(30 * sizeof(char*));
-    char *token;
+    char *read = line, *write = line;
 
     if (!tokens) {
         fprintf(stderr, "memory: allocation error\n");
         exit(EXIT_FAILURE);
     }
 
-    token = strtok(line, delim);
-    while (token != NULL) {
-		tokens[position] = token;
-        position++;
-        token = strtok(NULL, delim);
+    while (*read != '\0' && position < 29) {
+        int quoted = 0;
+        while (*read != '\0' && strchr(delim, *read)) read++;
+        if (*read == '\0') break;
+        tokens[position++] = write;
+        while (*read != '\0' && (quoted || !strchr(delim, *read))) {
+            if (*read == '"') quoted = !quoted;
+            else *write++ = *read;
+            read++;
+        }
+        if (*read != '\0') read++;
+        *write++ = '\0';
     }
 
     tokens[position] = NULL;
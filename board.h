@@ -38,6 +38,20 @@ public:
 	data info() const { return attr; }
 	data info(data dat) { data old = attr; attr = dat; return old; }
 
+	/**
+	 * pack the tiles into 64 bits, 4 bits per cell where cell i takes bits [4i, 4i + 4)
+	 */
+	data pack() const {
+		data raw = 0;
+		for (int i = 15; i >= 0; i--) raw = (raw << 4) | (operator()(i) & 0x0f);
+		return raw;
+	}
+	static board unpack(data raw) {
+		board b;
+		for (int i = 0; i < 16; i++, raw >>= 4) b(i) = raw & 0x0f;
+		return b;
+	}
+
 public:
 	bool operator ==(const board& b) const { return tile == b.tile; }
 	bool operator < (const board& b) const { return tile <  b.tile; }
@@ -75,42 +89,28 @@ public:
 	}
 
 	reward slide_left() {
-		board pre = (*this);
-		for (int r = 0; r < 4; r++) {
-			auto& row = tile[r];
-			for (int c = 1; c < 4; c++) {
-				if(row[c-1] == 0){
-					row[c-1] = row[c];
-					row[c] = 0;
-				} else if ((row[c-1] == 1 && row[c] == 2) || (row[c-1] == 2 && row[c] == 1)){
-					row[c-1] = 3;
-					row[c] = 0;
-				} else if (row[c-1] == row[c] && row[c-1] != 1 && row[c-1] != 2) {
-					row[c-1]++;
-					row[c] = 0;
-				}
-			}
-		}
-		if (pre == (*this)) return -1;
-		return score() - pre.score();
+		reward sum = 0;
+		bool moved = false;
+		for (int r = 0; r < 4; r++) moved |= shift(tile[r][0], tile[r][1], tile[r][2], tile[r][3], sum);
+		return moved ? sum : -1;
 	}
 	reward slide_right() {
-		reflect_horizontal();
-		reward score = slide_left();
-		reflect_horizontal();
-		return score;
+		reward sum = 0;
+		bool moved = false;
+		for (int r = 0; r < 4; r++) moved |= shift(tile[r][3], tile[r][2], tile[r][1], tile[r][0], sum);
+		return moved ? sum : -1;
 	}
 	reward slide_up() {
-		rotate_right();
-		reward score = slide_right();
-		rotate_left();
-		return score;
+		reward sum = 0;
+		bool moved = false;
+		for (int c = 0; c < 4; c++) moved |= shift(tile[0][c], tile[1][c], tile[2][c], tile[3][c], sum);
+		return moved ? sum : -1;
 	}
 	reward slide_down() {
-		rotate_right();
-		reward score = slide_left();
-		rotate_left();
-		return score;
+		reward sum = 0;
+		bool moved = false;
+		for (int c = 0; c < 4; c++) moved |= shift(tile[3][c], tile[2][c], tile[1][c], tile[0][c], sum);
+		return moved ? sum : -1;
 	}
 
 	void transpose() {
@@ -156,12 +156,51 @@ public:
 		reward s = 0;
 		for (auto& row : tile) {
 			for (auto t : row) {
-				if (t >= 3) s += pow(3.0, t-2);
+				s += tile_score(t);
 			}
 		}
 		return s;
 	}
 
+	/**
+	 * the legal slides as a bit mask, bit i is set if slide(i) changes the board
+	 */
+	unsigned legal_moves() const {
+		const lookup& t = tables();
+		unsigned moves = 0;
+		for (int i = 0; i < 4; i++) {
+			const row& r = tile[i];
+			if ((r[0] | r[1] | r[2] | r[3] | tile[0][i] | tile[1][i] | tile[2][i] | tile[3][i]) > 0x0f) return legal_moves_wide();
+			unsigned h = t.moves[r[0] | (r[1] << 4) | (r[2] << 8) | (r[3] << 12)];
+			unsigned v = t.moves[tile[0][i] | (tile[1][i] << 4) | (tile[2][i] << 8) | (tile[3][i] << 12)];
+			moves |= ((h & 1) << 3) | ((h & 2) << 0) | ((v & 1) << 0) | ((v & 2) << 1);
+		}
+		return moves;
+	}
+
+	/**
+	 * the empty cells as a bit mask, bit i is set if cell i is empty
+	 */
+	unsigned empty_mask() const {
+		unsigned mask = 0;
+		for (int i = 0; i < 16; i++) mask |= unsigned(operator()(i) == 0) << i;
+		return mask;
+	}
+
+	/**
+	 * the adjacent pairs of tiles that merge when slid together, i.e., 1 with 2, or equal tiles from 3 up
+	 */
+	unsigned mergeable_pairs() const {
+		unsigned pairs = 0;
+		for (int i = 0; i < 4; i++) {
+			for (int j = 0; j < 3; j++) {
+				pairs += mergeable(tile[i][j], tile[i][j + 1]);
+				pairs += mergeable(tile[j][i], tile[j + 1][i]);
+			}
+		}
+		return pairs;
+	}
+
 	cell max_cell() const {
 		cell max = 0;
 		for (auto& row : tile) {
@@ -172,6 +211,118 @@ public:
 		return max;
 	}
 
+protected:
+	/**
+	 * lookup tables for sliding a line of 4-bit cells towards its first cell, built at compile time
+	 * the line is indexed by cell i at bits [4i, 4i + 4), with cell 0 on the side it slides to
+	 */
+	struct lookup {
+		uint16_t line[65536]; // the line after the slide
+		int32_t gain[65536];  // the score difference, or -1 if a merge does not fit in 4 bits
+		reward score[16];     // the score of a tile, 3^(t-2) for t >= 3
+		uint8_t moves[65536]; // bit 0: the line can slide towards cell 0, bit 1: towards cell 3
+	};
+
+	static constexpr reward power(cell t) {
+		return t < 3 ? 0 : (t == 3 ? 3 : 3 * power(t - 1));
+	}
+	static reward tile_score(cell t) {
+		return t < 16 ? tables().score[t] : power(t);
+	}
+
+	static constexpr lookup make_lookup() {
+		lookup t = {};
+		for (cell v = 0; v < 16; v++) t.score[v] = power(v);
+		for (unsigned key = 0; key < 65536; key++) {
+			cell v[4] = { key & 0x0f, (key >> 4) & 0x0f, (key >> 8) & 0x0f, (key >> 12) & 0x0f };
+			reward pre = t.score[v[0]] + t.score[v[1]] + t.score[v[2]] + t.score[v[3]];
+			bool overflow = false;
+			for (int c = 1; c < 4; c++) {
+				if (v[c-1] == 0) {
+					v[c-1] = v[c];
+					v[c] = 0;
+				} else if ((v[c-1] == 1 && v[c] == 2) || (v[c-1] == 2 && v[c] == 1)) {
+					v[c-1] = 3;
+					v[c] = 0;
+				} else if (v[c-1] == v[c] && v[c-1] != 1 && v[c-1] != 2) {
+					overflow |= (v[c-1] == 0x0f);
+					v[c-1]++;
+					v[c] = 0;
+				}
+			}
+			t.line[key] = (v[0] & 0x0f) | (v[1] << 4) | (v[2] << 8) | (v[3] << 12);
+			t.gain[key] = overflow ? -1 : t.score[v[0]] + t.score[v[1]] + t.score[v[2] & 0x0f] + t.score[v[3] & 0x0f] - pre;
+		}
+		for (unsigned key = 0; key < 65536; key++) {
+			unsigned rev = ((key & 0x000f) << 12) | ((key & 0x00f0) << 4) | ((key & 0x0f00) >> 4) | ((key & 0xf000) >> 12);
+			t.moves[key] = (t.line[key] != key ? 1 : 0) | (t.line[rev] != rev ? 2 : 0);
+		}
+		return t;
+	}
+
+	static const lookup& tables() {
+		static constexpr lookup t = make_lookup();
+		return t;
+	}
+
+	/**
+	 * slide a line given from the side it slides to, accumulate the reward, and return whether it moved
+	 */
+	static bool shift(cell& a, cell& b, cell& c, cell& d, reward& sum) {
+		if ((a | b | c | d) > 0x0f) return shift_wide(a, b, c, d, sum);
+		unsigned key = a | (b << 4) | (c << 8) | (d << 12);
+		const lookup& t = tables();
+		if (t.gain[key] < 0) return shift_wide(a, b, c, d, sum);
+		unsigned line = t.line[key];
+		a = line & 0x0f;
+		b = (line >> 4) & 0x0f;
+		c = (line >> 8) & 0x0f;
+		d = (line >> 12);
+		sum += t.gain[key];
+		return line != key;
+	}
+
+	static bool mergeable(cell a, cell b) {
+		return (a == 1 && b == 2) || (a == 2 && b == 1) || (a == b && a >= 3);
+	}
+
+	unsigned legal_moves_wide() const {
+		unsigned moves = 0;
+		for (unsigned op = 0; op < 4; op++) {
+			board b = *this;
+			moves |= unsigned(b.slide(op) != -1) << op;
+		}
+		return moves;
+	}
+
+	/**
+	 * the rule-by-rule slide for lines whose cells do not fit in 4 bits
+	 */
+	static bool shift_wide(cell& a, cell& b, cell& c, cell& d, reward& sum) {
+		cell* v[4] = { &a, &b, &c, &d };
+		reward pre = tile_score(a) + tile_score(b) + tile_score(c) + tile_score(d);
+		bool moved = false;
+		for (int i = 1; i < 4; i++) {
+			cell& x = *v[i-1];
+			cell& y = *v[i];
+			if (x == 0) {
+				moved |= (y != 0);
+				x = y;
+				y = 0;
+			} else if ((x == 1 && y == 2) || (x == 2 && y == 1)) {
+				x = 3;
+				y = 0;
+				moved = true;
+			} else if (x == y && x != 1 && x != 2) {
+				x++;
+				y = 0;
+				moved = true;
+			}
+		}
+		sum += tile_score(a) + tile_score(b) + tile_score(c) + tile_score(d) - pre;
+		return moved;
+	}
+
 public:
 	friend std::ostream& operator <<(std::ostream& out, const board& b) {
 		std::array<int, 15> sequence({0, 1, 2, 3, 6, 12, 24, 48, 96, 192, 384, 768, 1536, 3072, 6144});
@@ -0,0 +1,111 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "board.h"
+
+/**
+ * binary corpus of player trajectories for offline training
+ *
+ * the file starts with a signature, followed by the episodes, and each episode
+ * is a uint32 length followed by that many steps in the order they were played
+ */
+class corpus {
+public:
+	static constexpr uint32_t signature = 0x50524354; // "TCRP"
+
+	struct step {
+		uint64_t after;  // the packed afterstate
+		int32_t reward;  // the reward of the slide
+		uint8_t hint;    // the hint given with the state before the slide
+		uint8_t move;    // the slide opcode
+		uint16_t reserved;
+	};
+
+	/**
+	 * append episodes to a corpus file, a new file gets the signature first
+	 */
+	class writer {
+	public:
+		writer(const std::string& path) : out(path, std::ios::out | std::ios::binary | std::ios::app) {
+			if (!out.is_open()) std::exit(-1);
+			uint32_t magic = signature;
+			if (out.tellp() == 0) out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+		}
+		void write(const std::vector<step>& steps) {
+			uint32_t length = steps.size();
+			out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+			out.write(reinterpret_cast<const char*>(steps.data()), sizeof(step) * length);
+		}
+	private:
+		std::ofstream out;
+	};
+
+public:
+	/**
+	 * map the corpus read-only and index the episodes
+	 */
+	corpus(const std::string& path) : base(nullptr), bytes(0) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		struct stat st;
+		if (fd < 0 || ::fstat(fd, &st) != 0) {
+			std::cerr << "corpus: cannot open " << path << std::endl;
+			std::exit(-1);
+		}
+		bytes = st.st_size;
+		if (bytes) base = static_cast<const char*>(::mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0));
+		::close(fd);
+		uint32_t magic = 0;
+		if (base == MAP_FAILED || bytes < sizeof(magic) || (std::memcpy(&magic, base, sizeof(magic)), magic != signature)) {
+			std::cerr << "corpus: " << path << " is not a trajectory corpus" << std::endl;
+			std::exit(-1);
+		}
+		for (size_t pos = sizeof(magic); pos + sizeof(uint32_t) <= bytes; ) {
+			uint32_t size;
+			std::memcpy(&size, base + pos, sizeof(size));
+			pos += sizeof(size);
+			if (pos + sizeof(step) * size > bytes) break; // truncated by an interrupted writer
+			episodes.push_back({ pos, size });
+			pos += sizeof(step) * size;
+		}
+	}
+	corpus(const corpus&) = delete;
+	corpus& operator =(const corpus&) = delete;
+	~corpus() {
+		if (base) ::munmap(const_cast<char*>(base), bytes);
+	}
+
+public:
+	size_t size() const { return episodes.size(); }
+	const step* trajectory(size_t i) const { return reinterpret_cast<const step*>(base + episodes[i].offset); }
+	size_t steps(size_t i) const { return episodes[i].size; }
+
+	/**
+	 * hint the kernel about the access pattern of the upcoming episodes
+	 */
+	void sequential() const {
+		::madvise(const_cast<char*>(base), bytes, MADV_SEQUENTIAL);
+	}
+	void prefetch(size_t i) const {
+		size_t page = ::sysconf(_SC_PAGESIZE);
+		size_t begin = episodes[i].offset / page * page;
+		size_t end = episodes[i].offset + sizeof(step) * episodes[i].size;
+		::madvise(const_cast<char*>(base) + begin, end - begin, MADV_WILLNEED);
+	}
+
+private:
+	struct entry {
+		size_t offset;
+		size_t size;
+	};
+	const char* base;
+	size_t bytes;
+	std::vector<entry> episodes;
+};
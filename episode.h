@@ -15,8 +15,29 @@ class statistic;
 
 class episode {
 friend class statistic;
+protected:
+	struct move;
+
 public:
-	episode() : ep_state(initial_state()), ep_score(0), ep_time(0) { ep_moves.reserve(10000); }
+	episode() : ep_state(initial_state()), ep_score(0), ep_time(0), ep_span{ 0, 0 } { ep_moves.swap(recycle().acquire()); }
+	episode(const episode& ep) = default;
+	episode(episode&& ep) = default;
+	episode& operator =(const episode& ep) = default;
+	episode& operator =(episode&& ep) = default;
+	~episode() { recycle().release(ep_moves); }
+
+	/**
+	 * start over as an empty episode, the move storage is kept for reuse
+	 */
+	void reset() {
+		ep_state = initial_state();
+		ep_score = 0;
+		ep_moves.clear();
+		ep_time = 0;
+		ep_span[0] = ep_span[1] = 0;
+		ep_open = {};
+		ep_close = {};
+	}
 
 public:
 	board& state() { return ep_state; }
@@ -34,6 +55,7 @@ public:
 		if (reward == -1) return false;
 		ep_moves.emplace_back(move, reward, millisec() - ep_time);
 		ep_score += reward;
+		account(ep_moves.size() - 1);
 		return true;
 	}
 	agent& take_turns(agent& play, agent& evil) {
@@ -54,38 +76,62 @@ public:
 		}
 	}
 
+	/**
+	 * the time spent by the given role, the per-role sums are kept up to date by account()
+	 * where the first move and the odd moves belong to the environment
+	 */
 	time_t time(unsigned who = -1u) const {
-		time_t time = 0;
-		size_t i = 2;
 		switch (who) {
-		case action::place::type:
-			if (ep_moves.size()) time += ep_moves[0].time, i = 1;
-			// no break;
-		case action::slide::type:
-			while (i < ep_moves.size()) time += ep_moves[i].time, i += 2;
-			break;
-		default:
-			time = ep_close.when - ep_open.when;
-			break;
+		case action::place::type: return ep_span[1];
+		case action::slide::type: return ep_span[0];
+		default:                  return ep_close.when - ep_open.when;
 		}
-		return time;
 	}
 
-	std::vector<action> actions(unsigned who = -1u) const {
-		std::vector<action> res;
-		size_t i = 2;
-		switch (who) {
-		case action::place::type:
-			if (ep_moves.size()) res.push_back(ep_moves[0]), i = 1;
-			// no break;
-		case action::slide::type:
-			while (i < ep_moves.size()) res.push_back(ep_moves[i]), i += 2;
-			break;
-		default:
-			res.assign(ep_moves.begin(), ep_moves.end());
-			break;
-		}
-		return res;
+	/**
+	 * a read-only view over the actions of the given role, the moves are not copied
+	 */
+	class action_view {
+	public:
+		class iterator {
+		public:
+			typedef std::forward_iterator_tag iterator_category;
+			typedef action value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef const action* pointer;
+			typedef const action& reference;
+
+			iterator(const std::vector<move>& moves, size_t i, unsigned who) : moves(&moves), i(std::min(i, moves.size())), who(who) {}
+			const action& operator *() const { return (*moves)[i].code; }
+			const action* operator ->() const { return &(*moves)[i].code; }
+			iterator& operator ++() {
+				switch (who) {
+				case action::place::type: i += (i == 0) ? 1 : 2; break;
+				case action::slide::type: i += 2; break;
+				default:                  i += 1; break;
+				}
+				i = std::min(i, moves->size());
+				return *this;
+			}
+			iterator operator ++(int) { iterator it = *this; ++(*this); return it; }
+			bool operator ==(const iterator& it) const { return i == it.i; }
+			bool operator !=(const iterator& it) const { return i != it.i; }
+		private:
+			const std::vector<move>* moves;
+			size_t i;
+			unsigned who;
+		};
+
+		action_view(const std::vector<move>& moves, unsigned who) : moves(moves), who(who) {}
+		iterator begin() const { return iterator(moves, who == action::slide::type ? 2 : 0, who); }
+		iterator end() const { return iterator(moves, moves.size(), who); }
+	private:
+		const std::vector<move>& moves;
+		unsigned who;
+	};
+
+	action_view actions(unsigned who = -1u) const {
+		return action_view(ep_moves, who);
 	}
 
 public:
@@ -97,7 +143,7 @@ public:
 		return out;
 	}
 	friend std::istream& operator >>(std::istream& in, episode& ep) {
-		ep = {};
+		ep.reset();
 		std::string token;
 		std::getline(in, token, '|');
 		std::stringstream(token) >> ep.ep_open;
@@ -106,12 +152,47 @@ public:
 			ep.ep_moves.emplace_back();
 			moves >> ep.ep_moves.back();
 			ep.ep_score += action(ep.ep_moves.back()).apply(ep.ep_state);
+			ep.account(ep.ep_moves.size() - 1);
 		}
 		std::getline(in, token, '|');
 		std::stringstream(token) >> ep.ep_close;
 		return in;
 	}
 
+	/**
+	 * decode a line of the text format above without streams, where the moves are applied
+	 * to the state only with 'replay', otherwise the state stays empty and the score is the
+	 * sum of the recorded rewards; return false if the line is malformed
+	 */
+	bool parse(const char* first, const char* last, bool replay = true) {
+		reset();
+		const char* p = first;
+		if (!parse(p, last, ep_open) || p == last || *p++ != '|') return false;
+		while (p != last && *p != '|') {
+			ep_moves.emplace_back();
+			move& m = ep_moves.back();
+			if (*p == '#') {
+				if (last - p < 2) return false;
+				const char* opc = "URDL";
+				unsigned op = std::find(opc, opc + 4, p[1]) - opc;
+				if (op >= 4) return false;
+				m.code = action::slide(op);
+			} else {
+				if (last - p < 2) return false;
+				unsigned pos = digit(p[0]), tile = digit(p[1]);
+				if (pos >= 16 || tile >= 36) return false;
+				m.code = action::place(pos, tile);
+			}
+			p += 2;
+			if (p != last && *p == '[') m.reward = number(++p, last), p += (p != last);
+			if (p != last && *p == '(') m.time = number(++p, last), p += (p != last);
+			ep_score += replay ? action(m).apply(ep_state) : m.reward;
+			account(ep_moves.size() - 1);
+		}
+		if (p == last || *p++ != '|') return false;
+		return parse(p, last, ep_close);
+	}
+
 protected:
 
 	struct move {
@@ -158,10 +239,71 @@ protected:
 		}
 	};
 
+	static unsigned digit(char c) {
+		return (c >= '0' && c <= '9') ? c - '0' : (c >= 'A' && c <= 'Z') ? c - 'A' + 10 : -1u;
+	}
+	static long long number(const char*& p, const char* last) {
+		bool negative = (p != last && *p == '-');
+		long long v = 0;
+		for (p += negative; p != last && *p >= '0' && *p <= '9'; p++) v = v * 10 + (*p - '0');
+		return negative ? -v : v;
+	}
+	static bool parse(const char*& p, const char* last, meta& m) {
+		const char* at = std::find(p, last, '@');
+		if (at == last) return false;
+		m.tag.assign(p, at);
+		p = at + 1;
+		m.when = number(p, last);
+		return true;
+	}
+
+	void account(size_t i) {
+		ep_span[(i == 0 || i % 2) ? 1 : 0] += ep_moves[i].time;
+	}
+
+	/**
+	 * a per-thread slab of move buffers, the storage of evicted episodes is handed to new ones
+	 * so that the buffers keep their geometrically grown capacity instead of being reallocated
+	 */
+	class slab {
+	public:
+		std::vector<move>& acquire() {
+			spare.clear();
+			if (pool.size()) spare.swap(pool.back()), pool.pop_back();
+			else spare.reserve(256);
+			return spare;
+		}
+		void release(std::vector<move>& moves) {
+			if (moves.capacity() == 0 || pool.size() >= 64) return;
+			moves.clear();
+			pool.emplace_back();
+			pool.back().swap(moves);
+		}
+	private:
+		std::vector<std::vector<move>> pool;
+		std::vector<move> spare;
+	};
+	static slab& recycle() {
+		static thread_local slab s;
+		return s;
+	}
+
 	static board initial_state() {
 		return {};
 	}
+
+public:
+	/**
+	 * whether the wall clock is recorded, disable it to make the records reproducible
+	 */
+	static bool& clocked() {
+		static bool enabled = true;
+		return enabled;
+	}
+
+protected:
 	static time_t millisec() {
+		if (!clocked()) return 0;
 		auto now = std::chrono::system_clock::now().time_since_epoch();
 		return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
 	}
@@ -171,6 +313,7 @@ private:
 	board::reward ep_score;
 	std::vector<move> ep_moves;
 	time_t ep_time;
+	time_t ep_span[2];
 
 	meta ep_open;
 	meta ep_close;
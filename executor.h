@@ -0,0 +1,117 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+/**
+ * persistent pool of worker threads with work stealing
+ *
+ * each worker has its own queue: it takes the newest task of its own queue first, and
+ * takes the oldest task of another queue when its own runs dry; a task gets the index of
+ * the worker that runs it, so that it can use the per-worker state of the caller
+ */
+class executor {
+public:
+	typedef std::function<void(size_t)> task;
+
+	/**
+	 * start the workers, each of which runs the given setup first, e.g., to pin itself
+	 */
+	executor(size_t threads, task setup = task()) : queues(std::max<size_t>(threads, 1)), next(0), queued(0), pending(0), quit(false) {
+		for (size_t i = 0; i < queues.size(); i++) queues[i].reset(new queue());
+		for (size_t i = 0; i < queues.size(); i++) workers.emplace_back(&executor::work, this, i, setup);
+	}
+	executor(const executor&) = delete;
+	executor& operator =(const executor&) = delete;
+
+	/**
+	 * finish the submitted tasks, then stop the workers
+	 */
+	~executor() {
+		wait();
+		{ std::lock_guard<std::mutex> guard(lock); quit = true; }
+		signal.notify_all();
+		for (std::thread& t : workers) t.join();
+	}
+
+	size_t size() const { return queues.size(); }
+
+	/**
+	 * queue a task, the queues are filled in turn
+	 */
+	void submit(task t) {
+		queue& q = *queues[next++ % queues.size()];
+		{ std::lock_guard<std::mutex> guard(lock); pending++; }
+		{ std::lock_guard<std::mutex> guard(q.lock); q.tasks.push_back(std::move(t)); }
+		{ std::lock_guard<std::mutex> guard(lock); queued++; }
+		signal.notify_one();
+	}
+
+	/**
+	 * block until every submitted task is finished
+	 */
+	void wait() {
+		std::unique_lock<std::mutex> guard(lock);
+		done.wait(guard, [this]() { return pending == 0; });
+	}
+
+protected:
+	struct queue {
+		std::mutex lock;
+		std::deque<task> tasks;
+	};
+
+	bool take(size_t id, task& t) {
+		queue& own = *queues[id];
+		{
+			std::lock_guard<std::mutex> guard(own.lock);
+			if (own.tasks.size()) {
+				t = std::move(own.tasks.back());
+				own.tasks.pop_back();
+				return true;
+			}
+		}
+		for (size_t k = 1; k < queues.size(); k++) { // steal from the others, the oldest first
+			queue& victim = *queues[(id + k) % queues.size()];
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (victim.tasks.size()) {
+				t = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work(size_t id, task setup) {
+		if (setup) setup(id);
+		while (true) {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				signal.wait(guard, [this]() { return queued > 0 || quit; });
+				if (queued == 0) return;
+				queued--;
+			}
+			task t;
+			while (!take(id, t)) std::this_thread::yield(); // the counted task is in some queue
+			t(id);
+			std::lock_guard<std::mutex> guard(lock);
+			if (--pending == 0) done.notify_all();
+		}
+	}
+
+private:
+	std::vector<std::unique_ptr<queue>> queues;
+	std::vector<std::thread> workers;
+	size_t next;
+	std::mutex lock;
+	std::condition_variable signal;
+	std::condition_variable done;
+	size_t queued;  // the tasks in the queues that no worker has claimed yet
+	size_t pending; // the tasks not finished yet
+	bool quit;
+};
@@ -0,0 +1,57 @@
+/**
+ * C interface of Three for external callers
+ * use 'g++ -std=c++14 -O3 -g -fPIC -shared -o libthree.so libthree.cpp' to compile the source
+ */
+
+#include <string>
+#include "board.h"
+#include "agent.h"
+#include "libthree.h"
+
+static_assert(sizeof(int) == sizeof(int32_t), "hints and moves are passed through as int");
+
+struct three_model {
+	player play;
+	three_model(const std::string& args) : play(args + " alpha=0") {}
+};
+
+three_model* three_open(const char* args) {
+	three_model* model = nullptr;
+	try {
+		model = new three_model(args ? args : "");
+	} catch (const std::exception&) { // e.g., a weight file that cannot be loaded
+		return nullptr;
+	}
+	if (model->play.tables() == 0) {
+		delete model;
+		return nullptr;
+	}
+	return model;
+}
+
+void three_close(three_model* model) {
+	delete model;
+}
+
+void three_evaluate(const three_model* model, const uint64_t* boards, const int32_t* hints,
+	float* values, int32_t* moves, size_t n) {
+	static constexpr size_t chunk = 1024;
+	board states[chunk];
+	int safe[chunk]; // the hints that are not tiles are evaluated as 0, then reported as no slide
+	bool rejected[chunk];
+	for (size_t first = 0; first < n; first += chunk) {
+		size_t size = std::min(chunk, n - first);
+		for (size_t i = 0; i < size; i++) {
+			states[i] = board::unpack(boards[first + i]);
+			rejected[i] = !player::valid_hint(hints[first + i]);
+			safe[i] = rejected[i] ? 0 : hints[first + i];
+		}
+		int* picks = moves ? reinterpret_cast<int*>(moves + first) : nullptr;
+		model->play.evaluate(states, safe, values + first, picks, size);
+		for (size_t i = 0; i < size; i++) {
+			if (!rejected[i]) continue;
+			values[first + i] = 0;
+			if (picks) picks[i] = -1;
+		}
+	}
+}
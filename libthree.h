@@ -0,0 +1,35 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * C interface to evaluate boards with trained weights, built as libthree.so by 'make lib'
+ *
+ * a board is packed as by board::pack(), 4 bits per cell with cell 0 in the lowest bits,
+ * and the hint is the next tile as given to the player (0 if unknown)
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct three_model three_model;
+
+/**
+ * open the weights with player arguments, e.g., "load=weights.bin mmap=1", the tables are
+ * never updated; returns NULL if no table is loaded, or if the file cannot be loaded
+ */
+three_model* three_open(const char* args);
+
+void three_close(three_model* model);
+
+/**
+ * write the greedy value (0 if no slide is legal) of n boards to values, and the slides
+ * (-1 if none is legal) to moves unless it is NULL; a hint outside 0 to 15 gives 0 and -1;
+ * safe to call from several threads
+ */
+void three_evaluate(const three_model* model, const uint64_t* boards, const int32_t* hints,
+	float* values, int32_t* moves, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,198 @@
+#pragma once
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <unistd.h>
+#include "board.h"
+
+/**
+ * process-wide counters of a training run, exported in the Prometheus text format
+ *
+ * the counters are relaxed atomics bumped once per episode, so the hot path never waits;
+ * the rates and the gauges are derived by the writer thread from two consecutive samples
+ */
+class metrics {
+private:
+	struct sample;
+
+public:
+	static metrics& instance() {
+		static metrics m;
+		return m;
+	}
+
+	/**
+	 * count a finished game with its score, its largest tile, and the slides of the player
+	 */
+	void game(board::reward score, board::cell tile, size_t moves) {
+		games.fetch_add(1, std::memory_order_relaxed);
+		slides.fetch_add(moves, std::memory_order_relaxed);
+		scores.fetch_add(score, std::memory_order_relaxed);
+		tiles[std::min<size_t>(tile, 15)].fetch_add(1, std::memory_order_relaxed);
+		last_game.store(now(), std::memory_order_relaxed);
+	}
+
+	/**
+	 * count the absolute TD errors of the steps trained in an episode
+	 */
+	void td(double error, size_t steps) {
+		add(td_error, error);
+		td_steps.fetch_add(steps, std::memory_order_relaxed);
+	}
+
+	/**
+	 * mark the completion of a checkpoint
+	 */
+	void checkpoint() {
+		last_checkpoint.store(now(), std::memory_order_relaxed);
+	}
+
+	/**
+	 * rewrite a text file every few seconds, e.g., for the textfile collector of node_exporter
+	 * the file is replaced atomically, so a scrape never reads a partial file
+	 */
+	class writer {
+	public:
+		writer(const std::string& path, double interval = 10) : path(path), interval(interval), quit(false),
+			thread(&writer::loop, this) {}
+		writer(const writer&) = delete;
+		writer& operator =(const writer&) = delete;
+		~writer() {
+			{ std::lock_guard<std::mutex> guard(lock); quit = true; }
+			signal.notify_all();
+			thread.join();
+		}
+
+	private:
+		void loop() {
+			metrics& m = instance();
+			sample last = m.take();
+			std::unique_lock<std::mutex> guard(lock);
+			while (true) {
+				bool stop = signal.wait_for(guard, std::chrono::duration<double>(interval), [this]() { return quit; });
+				sample next = m.take();
+				write(last, next);
+				last = next;
+				if (stop) return;
+			}
+		}
+
+		void write(const sample& last, const sample& next) const {
+			metrics& m = instance();
+			double span = std::max(next.time - last.time, 1e-9);
+			uint64_t games = next.games - last.games;
+			std::ostringstream out;
+			out << std::setprecision(10);
+			out << "# HELP three_games_total Games played." "\n" "# TYPE three_games_total counter" "\n";
+			out << "three_games_total " << next.games << "\n";
+			out << "# HELP three_moves_total Slides made by the player." "\n" "# TYPE three_moves_total counter" "\n";
+			out << "three_moves_total " << next.slides << "\n";
+			out << "# HELP three_score_total Sum of the game scores." "\n" "# TYPE three_score_total counter" "\n";
+			out << "three_score_total " << next.scores << "\n";
+			out << "# HELP three_max_tile_total Games ended with the given largest tile." "\n" "# TYPE three_max_tile_total counter" "\n";
+			for (size_t t = 1; t < 16; t++) {
+				uint64_t count = m.tiles[t].load(std::memory_order_relaxed);
+				if (count) out << "three_max_tile_total{tile=\"" << (t < 4 ? t : 3u << (t - 3)) << "\"} " << count << "\n";
+			}
+			out << "# HELP three_td_error_sum Sum of the absolute TD errors." "\n" "# TYPE three_td_error_sum counter" "\n";
+			out << "three_td_error_sum " << next.error << "\n";
+			out << "# HELP three_td_steps_total Trained steps." "\n" "# TYPE three_td_steps_total counter" "\n";
+			out << "three_td_steps_total " << next.steps << "\n";
+			out << "# HELP three_games_per_second Games per second over the last interval." "\n" "# TYPE three_games_per_second gauge" "\n";
+			out << "three_games_per_second " << (games / span) << "\n";
+			out << "# HELP three_moves_per_second Slides per second over the last interval." "\n" "# TYPE three_moves_per_second gauge" "\n";
+			out << "three_moves_per_second " << ((next.slides - last.slides) / span) << "\n";
+			out << "# HELP three_average_score Average score over the last interval." "\n" "# TYPE three_average_score gauge" "\n";
+			out << "three_average_score " << (games ? double(next.scores - last.scores) / games : 0) << "\n";
+			out << "# HELP three_td_error Mean absolute TD error over the last interval." "\n" "# TYPE three_td_error gauge" "\n";
+			out << "three_td_error " << (next.steps > last.steps ? (next.error - last.error) / (next.steps - last.steps) : 0) << "\n";
+			out << "# HELP three_resident_bytes Resident memory of the process." "\n" "# TYPE three_resident_bytes gauge" "\n";
+			out << "three_resident_bytes " << resident() << "\n";
+			out << "# HELP three_peak_resident_bytes Peak resident memory of the process." "\n" "# TYPE three_peak_resident_bytes gauge" "\n";
+			out << "three_peak_resident_bytes " << peak() << "\n";
+			out << "# HELP three_last_game_seconds Unix time of the last finished game." "\n" "# TYPE three_last_game_seconds gauge" "\n";
+			out << "three_last_game_seconds " << m.last_game.load(std::memory_order_relaxed) << "\n";
+			double checkpoint = m.last_checkpoint.load(std::memory_order_relaxed);
+			if (checkpoint) {
+				out << "# HELP three_checkpoint_lag_seconds Seconds since the last completed checkpoint." "\n" "# TYPE three_checkpoint_lag_seconds gauge" "\n";
+				out << "three_checkpoint_lag_seconds " << (next.time - checkpoint) << "\n";
+			}
+			out << "# HELP three_start_time_seconds Unix time when the process started." "\n" "# TYPE three_start_time_seconds gauge" "\n";
+			out << "three_start_time_seconds " << m.start << "\n";
+
+			std::string temp = path + ".tmp";
+			std::ofstream file(temp, std::ios::out | std::ios::trunc);
+			file << out.str();
+			file.close();
+			if (!file || std::rename(temp.c_str(), path.c_str()) != 0)
+				std::cerr << "metrics: failed to write " << path << std::endl;
+		}
+
+		static size_t resident() {
+			std::ifstream in("/proc/self/statm");
+			size_t pages = 0, rss = 0;
+			in >> pages >> rss;
+			return rss * sysconf(_SC_PAGESIZE);
+		}
+		static size_t peak() {
+			std::ifstream in("/proc/self/status");
+			for (std::string line; std::getline(in, line); )
+				if (line.find("VmHWM:") == 0) return std::stoull(line.substr(6)) * 1024;
+			return 0;
+		}
+
+	private:
+		std::string path;
+		double interval;
+		bool quit;
+		std::mutex lock;
+		std::condition_variable signal;
+		std::thread thread;
+	};
+
+private:
+	metrics() : games(0), slides(0), scores(0), td_steps(0), td_error(0), last_game(0), last_checkpoint(0), start(now()) {
+		for (auto& t : tiles) t.store(0, std::memory_order_relaxed);
+	}
+
+	struct sample {
+		double time;
+		uint64_t games;
+		uint64_t slides;
+		uint64_t scores;
+		uint64_t steps;
+		double error;
+	};
+	sample take() const {
+		return { now(), games.load(std::memory_order_relaxed), slides.load(std::memory_order_relaxed),
+			scores.load(std::memory_order_relaxed), td_steps.load(std::memory_order_relaxed), td_error.load(std::memory_order_relaxed) };
+	}
+
+	static double now() {
+		return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+	static void add(std::atomic<double>& sum, double value) {
+		double old = sum.load(std::memory_order_relaxed);
+		while (!sum.compare_exchange_weak(old, old + value, std::memory_order_relaxed));
+	}
+
+private:
+	std::atomic<uint64_t> games;
+	std::atomic<uint64_t> slides;
+	std::atomic<uint64_t> scores;
+	std::atomic<uint64_t> tiles[16];
+	std::atomic<uint64_t> td_steps;
+	std::atomic<double> td_error;
+	std::atomic<double> last_game;
+	std::atomic<double> last_checkpoint;
+	double start;
+};
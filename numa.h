@@ -0,0 +1,135 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/**
+ * NUMA placement of memory and thread pinning, based on the raw system calls
+ * so that no libnuma is required; on single-node hosts everything is a no-op
+ */
+class numa {
+public:
+	enum policy {
+		none,       // first-touch placement by the kernel
+		interleave, // pages spread round-robin over all nodes
+		local,      // pages bound to the node of the current thread
+		replicate,  // one read-only copy per node, reads go to the copy of the current node
+	};
+
+	static policy parse(const std::string& name) {
+		if (name == "interleave") return interleave;
+		if (name == "local") return local;
+		if (name == "replicate") return replicate;
+		return none;
+	}
+
+	/**
+	 * the number of configured nodes, from /sys/devices/system/node/possible
+	 */
+	static int nodes() {
+		static int count = []() -> int {
+			std::ifstream in("/sys/devices/system/node/possible");
+			std::string list;
+			if (!(in >> list)) return 1;
+			std::vector<int> ids = parse_list(list);
+			return ids.size() ? ids.back() + 1 : 1;
+		}();
+		return count;
+	}
+
+	/**
+	 * the node the current thread runs on, updated by pin()
+	 */
+	static int& current() {
+		static thread_local int node = -1;
+		if (node < 0) node = node_of(sched_getcpu());
+		return node;
+	}
+
+	static int node_of(int cpu) {
+		for (int n = 0; n < nodes(); n++) {
+			std::ifstream in("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+			std::string list;
+			if (!(in >> list)) continue;
+			for (int c : parse_list(list)) if (c == cpu) return n;
+		}
+		return 0;
+	}
+
+	/**
+	 * apply the policy to a fresh mapping, must be called before the pages are touched
+	 */
+	static bool place(void* addr, size_t len, policy pol, int node = -1) {
+		if (nodes() <= 1 || pol == none || pol == replicate) return true;
+		std::vector<unsigned long> mask((nodes() + 63) / 64, 0);
+		int mode;
+		if (pol == interleave) {
+			for (int n = 0; n < nodes(); n++) mask[n / 64] |= 1ul << (n % 64);
+			mode = 3; // MPOL_INTERLEAVE
+		} else {
+			if (node < 0) node = current();
+			mask[node / 64] |= 1ul << (node % 64);
+			mode = 2; // MPOL_BIND
+		}
+		return syscall(SYS_mbind, addr, len, mode, mask.data(), mask.size() * 64 + 1, 0) == 0;
+	}
+
+	/**
+	 * pin the current thread to the given cpu list, e.g., "0-7,16-23"
+	 */
+	static bool pin(const std::string& cpus) {
+		return pin(parse_list(cpus));
+	}
+	static bool pin(const std::vector<int>& ids) {
+		if (ids.empty()) return false;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int c : ids) CPU_SET(c, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) return false;
+		current() = node_of(ids.front());
+		return true;
+	}
+
+	/**
+	 * one of the parts a cpu list is split into, e.g., for each thread of a pool: ranges of
+	 * about equal size, or one cpu each, in turn, if there are fewer cpus than parts
+	 */
+	static std::vector<int> part(const std::vector<int>& ids, size_t index, size_t parts) {
+		if (ids.empty()) return ids;
+		if (ids.size() < parts) return { ids[index % ids.size()] };
+		return std::vector<int>(ids.begin() + ids.size() * index / parts, ids.begin() + ids.size() * (index + 1) / parts);
+	}
+
+	/**
+	 * parse a kernel-style list such as "0-3,8,10-11", where each id must fit in a cpu_set_t
+	 */
+	static std::vector<int> parse_list(const std::string& list) {
+		std::vector<int> ids;
+		std::stringstream ss(list);
+		for (std::string item; std::getline(ss, item, ','); ) {
+			if (item.empty()) continue;
+			size_t dash = item.find('-');
+			int first = parse_id(item.substr(0, dash), list);
+			int last = dash == std::string::npos ? first : parse_id(item.substr(dash + 1), list);
+			if (last < first) throw std::runtime_error("numa: invalid range " + item + " in list " + list);
+			for (int c = first; c <= last; c++) ids.push_back(c);
+		}
+		return ids;
+	}
+
+private:
+	static int parse_id(const std::string& id, const std::string& list) {
+		if (id.empty() || id.size() > 9 || id.find_first_not_of("0123456789") != std::string::npos)
+			throw std::runtime_error("numa: invalid id '" + id + "' in list " + list);
+		int value = std::stoi(id);
+		if (value >= CPU_SETSIZE)
+			throw std::runtime_error("numa: id " + id + " in list " + list + " is not below " + std::to_string(CPU_SETSIZE));
+		return value;
+	}
+};
@@ -0,0 +1,228 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+
+/**
+ * the state of a playout: the board, the bag, and the next tile, copied by value and
+ * advanced by the same rules as rndenv, with its own xorshift generator and no allocation
+ */
+class playout {
+public:
+	playout(uint64_t seed) : next(0), bag{ 0, 0, 0, 0 }, rng(seed | 1) {}
+
+	/**
+	 * start from a state and the hint of its next tile, the bag is unknown and starts full
+	 */
+	void reset(const board& b, int hint) {
+		state = b;
+		next = hint;
+		bag[1] = bag[2] = bag[3] = 4;
+		if (hint >= 1 && hint <= 3) bag[hint]--;
+	}
+
+	board::reward slide(unsigned op) {
+		return state.slide(op);
+	}
+
+	/**
+	 * place the next tile on the edge opposite to the last slide, false if the edge is full
+	 */
+	bool place() {
+		static constexpr unsigned edge[4] = { 0xF000, 0x1111, 0x000F, 0x8888 }; // opposite to U, R, D, L
+		unsigned empty = state.empty_mask() & (state.last_op < 4 ? edge[state.last_op] : 0xFFFF);
+		if (!empty) return false;
+		unsigned pos = nth(empty, random() % count(empty));
+		board::cell max = state.max_cell();
+		state.place(pos, next);
+		if (max >= 7 && uniform() <= 1.0 / 21.0) next = std::round(4 + uniform() * (max - 7));
+		else next = draw();
+		return true;
+	}
+
+	/**
+	 * play on from the current afterstate by random slides, or by the greedy choice of
+	 * the policy if any, and return the sum of the rewards; depth 0 plays to the end
+	 */
+	board::reward run(const player* policy, size_t depth) {
+		board::reward total = 0;
+		for (size_t d = 0; !depth || d < depth; d++) {
+			if (!place()) break;
+			unsigned legal = state.legal_moves();
+			if (!legal) break;
+			int op = policy ? policy->best_move(state, next) : nth(legal, random() % count(legal));
+			total += state.slide(op);
+		}
+		return total;
+	}
+
+protected:
+	board::cell draw() {
+		if (bag[1] + bag[2] + bag[3] == 0) bag[1] = bag[2] = bag[3] = 4;
+		unsigned pick = random() % (bag[1] + bag[2] + bag[3]);
+		board::cell tile = pick < bag[1] ? 1 : pick < bag[1] + bag[2] ? 2 : 3;
+		bag[tile]--;
+		return tile;
+	}
+
+	uint64_t random() {
+		rng ^= rng >> 12;
+		rng ^= rng << 25;
+		rng ^= rng >> 27;
+		return rng * 0x2545f4914f6cdd1dull;
+	}
+	double uniform() {
+		return (random() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	static unsigned count(unsigned mask) {
+		return __builtin_popcount(mask);
+	}
+	static unsigned nth(unsigned mask, unsigned n) {
+		while (n--) mask &= mask - 1;
+		return __builtin_ctz(mask);
+	}
+
+private:
+	board state;
+	board::cell next;
+	uint8_t bag[4];
+	uint64_t rng;
+};
+
+/**
+ * Monte-Carlo rollout player
+ *
+ * each legal slide is scored by the mean return of the playouts that follow it, and the
+ * slide with the best mean is taken; the playouts run on a pool of threads that keep their
+ * own root statistics, until 'playouts' per slide are done or the 'budget' (ms) runs out
+ */
+class rollout : public agent {
+public:
+	rollout(const std::string& args = "", const player* weights = nullptr) : agent("name=rollout role=player " + args),
+		policy(nullptr), threads(1), playouts(100), budget(0), depth(0), seed(0), serial(0), generation(0), running(0), quit(false) {
+		if (meta.find("policy") != meta.end() && std::string(meta["policy"]) == "greedy") { // pass policy=greedy to play out by the weights
+			if (!weights || weights->tables() == 0)
+				throw std::runtime_error("rollout: policy=greedy requires weights, e.g., --play=\"load=weights.bin\"");
+			policy = weights;
+		}
+		if (meta.find("thread") != meta.end()) // pass thread=... to run the playouts on N threads
+			threads = std::max(int(meta["thread"]), 1);
+		if (meta.find("playouts") != meta.end()) // pass playouts=... to limit the playouts per slide
+			playouts = size_t(meta["playouts"]);
+		if (meta.find("budget") != meta.end()) // pass budget=... to limit the time per move in milliseconds
+			budget = double(meta["budget"]);
+		if (meta.find("depth") != meta.end()) // pass depth=... to cut the playouts after N slides
+			depth = size_t(meta["depth"]);
+		if (meta.find("seed") != meta.end())
+			seed = uint64_t(meta["seed"]);
+		tallies.resize(threads);
+		for (size_t id = 1; id < threads; id++) pool.emplace_back(&rollout::work, this, id);
+	}
+	virtual ~rollout() {
+		{ std::lock_guard<std::mutex> guard(lock); quit = true; }
+		signal.notify_all();
+		for (std::thread& t : pool) t.join();
+	}
+
+	virtual action take_action(const board& before, int& hint) {
+		unsigned legal = before.legal_moves();
+		if (!legal) return action();
+		root = before;
+		root_hint = hint;
+		root_legal = legal;
+		deadline = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::milli>(budget));
+		serial++;
+		{ std::lock_guard<std::mutex> guard(lock); generation++; running = threads - 1; }
+		signal.notify_all();
+		search(0);
+		{ std::unique_lock<std::mutex> guard(lock); signal.wait(guard, [this]() { return running == 0; }); }
+
+		int best = -1;
+		double best_mean = 0;
+		for (int op = 0; op < 4; op++) {
+			if (!(legal & (1u << op))) continue;
+			double sum = 0;
+			size_t count = 0;
+			for (const tally& t : tallies) sum += t.sum[op], count += t.count[op];
+			double mean = count ? sum / count : 0;
+			if (best == -1 || mean > best_mean) best = op, best_mean = mean;
+		}
+		return action::slide(best);
+	}
+
+protected:
+	typedef std::chrono::steady_clock clock;
+
+	struct tally { // one per thread, padded so that two threads never write the same cache line
+		double sum[4];
+		size_t count[4];
+		char padding[64];
+	};
+
+	/**
+	 * run this thread's share of the playouts of the current move, round-robin over the slides
+	 */
+	void search(size_t id) {
+		tally& t = tallies[id];
+		t = {};
+		playout game(random_agent::derive(seed ^ (uint64_t(id) << 40) ^ serial));
+		size_t quota = (playouts + threads - 1) / threads;
+		for (size_t n = 0; n < quota; n++) {
+			if (budget && clock::now() >= deadline) break;
+			for (int op = 0; op < 4; op++) {
+				if (!(root_legal & (1u << op))) continue;
+				game.reset(root, root_hint);
+				board::reward value = game.slide(op);
+				value += game.run(policy, depth);
+				t.sum[op] += value;
+				t.count[op]++;
+			}
+		}
+	}
+
+	void work(size_t id) {
+		uint64_t seen = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				signal.wait(guard, [&]() { return quit || generation != seen; });
+				if (quit) return;
+				seen = generation;
+			}
+			search(id);
+			{ std::lock_guard<std::mutex> guard(lock); running--; }
+			signal.notify_all();
+		}
+	}
+
+private:
+	const player* policy;
+	size_t threads;
+	size_t playouts;
+	double budget;
+	size_t depth;
+	uint64_t seed;
+
+	board root;
+	int root_hint;
+	unsigned root_legal;
+	clock::time_point deadline;
+	uint64_t serial;
+
+	std::vector<tally> tallies;
+	std::vector<std::thread> pool;
+	std::mutex lock;
+	std::condition_variable signal;
+	uint64_t generation;
+	size_t running;
+	bool quit;
+};
@@ -0,0 +1,199 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <csignal>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "board.h"
+#include "agent.h"
+
+/**
+ * persistent move server over a unix domain socket
+ *
+ * each request is 16 bytes: the packed board (uint64), the hint (uint32), and a tag (uint32)
+ * each response is 16 bytes: the tag (uint32), the slide opcode or -1 (int32),
+ * the reward of the slide (int32), and the estimated value (float), all in host byte order
+ *
+ * the requests that arrive together from all clients are answered as one batch, a request
+ * whose hint is not a tile (0 to 15) is answered with -1; the responses are queued per client
+ * and sent without blocking, and a client that leaves too many of them unread is dropped
+ */
+class server {
+public:
+	struct request {
+		uint64_t board;
+		uint32_t hint;
+		uint32_t tag;
+	};
+	struct response {
+		uint32_t tag;
+		int32_t move;
+		int32_t reward;
+		float value;
+	};
+
+public:
+	server(const player& play, const std::string& path, double report = 10) : play(play), path(path), report(report), listener(-1) {}
+	~server() {
+		for (client& c : clients) ::close(c.fd);
+		if (listener >= 0) ::close(listener), ::unlink(path.c_str());
+	}
+
+	/**
+	 * serve until SIGINT or SIGTERM arrives
+	 */
+	bool run() {
+		listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		if (listener < 0 || path.size() >= sizeof(addr.sun_path)) return false;
+		path.copy(addr.sun_path, path.size());
+		::unlink(path.c_str());
+		if (::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) return false;
+		if (::listen(listener, 128) != 0) return false;
+		std::signal(SIGINT, stop);
+		std::signal(SIGTERM, stop);
+		std::signal(SIGPIPE, SIG_IGN);
+
+		auto last = clock::now();
+		std::vector<pollfd> fds;
+		std::vector<std::pair<size_t, request>> batch;
+		while (!stopped()) {
+			fds.assign(1, { listener, POLLIN, 0 });
+			for (client& c : clients) fds.push_back({ c.fd, short(c.output.empty() ? POLLIN : POLLIN | POLLOUT), 0 });
+			if (::poll(fds.data(), fds.size(), 1000) < 0 && errno != EINTR) break;
+			auto arrival = clock::now();
+
+			batch.clear();
+			for (size_t i = 1; i < fds.size(); i++) {
+				client& c = clients[i - 1];
+				if (fds[i].revents & POLLOUT) flush(c);
+				if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)) || c.closed) continue;
+				ssize_t n = ::recv(c.fd, c.buffer + c.size, sizeof(c.buffer) - c.size, MSG_DONTWAIT);
+				if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+				if (n <= 0) { c.closed = true; continue; }
+				c.size += n;
+				size_t used = 0;
+				for (; c.size - used >= sizeof(request); used += sizeof(request)) {
+					request req;
+					std::memcpy(&req, c.buffer + used, sizeof(req));
+					batch.emplace_back(i - 1, req);
+				}
+				std::memmove(c.buffer, c.buffer + used, c.size - used);
+				c.size -= used;
+			}
+			if (fds[0].revents & POLLIN) {
+				int fd = ::accept(listener, nullptr, nullptr);
+				if (fd >= 0) clients.push_back({ fd });
+			}
+
+			answer(batch, arrival);
+			clients.erase(std::remove_if(clients.begin(), clients.end(), [](const client& c) {
+				if (c.closed) ::close(c.fd);
+				return c.closed;
+			}), clients.end());
+
+			if (std::chrono::duration<double>(clock::now() - last).count() >= report) {
+				show();
+				last = clock::now();
+			}
+		}
+		show();
+		return true;
+	}
+
+protected:
+	typedef std::chrono::steady_clock clock;
+
+	struct client {
+		int fd;
+		size_t size = 0;
+		bool closed = false;
+		char buffer[sizeof(request) * 256] = {};
+		std::string output; // the responses not sent yet
+		client(int fd) : fd(fd) {}
+	};
+
+	void answer(const std::vector<std::pair<size_t, request>>& batch, clock::time_point arrival) {
+		if (batch.empty()) return;
+		for (auto& item : batch) {
+			const request& req = item.second;
+			double value = 0;
+			int reward = 0;
+			int move = player::valid_hint(req.hint) ? play.best_move(board::unpack(req.board), req.hint, &value, &reward) : -1;
+			response res = { req.tag, move, move != -1 ? reward : 0, float(move != -1 ? value : 0) };
+			clients[item.first].output.append(reinterpret_cast<const char*>(&res), sizeof(res));
+		}
+		for (client& c : clients) {
+			if (c.output.size() && !c.closed) flush(c);
+			if (c.output.size() > max_output) c.closed = true; // the client stopped reading
+		}
+		size_t micros = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - arrival).count();
+		for (size_t i = 0; i < batch.size(); i++) latency[bucket(micros)]++;
+		served += batch.size();
+		batches++;
+	}
+
+	/**
+	 * send the queued responses of a client as far as its socket takes them
+	 */
+	static void flush(client& c) {
+		size_t sent = 0;
+		while (sent < c.output.size()) {
+			ssize_t n = ::send(c.fd, c.output.data() + sent, c.output.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) break;
+			if (n <= 0) { c.closed = true; break; }
+			sent += n;
+		}
+		c.output.erase(0, sent);
+	}
+	static constexpr size_t max_output = sizeof(response) * 65536;
+
+	/**
+	 * print the request count, the average batch size, and the latency percentiles
+	 */
+	void show() const {
+		std::ios ff(nullptr);
+		ff.copyfmt(std::cout);
+		std::cout << std::fixed << std::setprecision(1);
+		std::cout << served << "\t" << "requests, batch = " << (batches ? double(served) / batches : 0);
+		std::cout << ", p50 = " << percentile(0.5) << "us, p99 = " << percentile(0.99) << "us" << std::endl;
+		std::cout.copyfmt(ff);
+	}
+
+	static constexpr size_t octave = 8;
+	static size_t bucket(size_t micros) {
+		return std::min<size_t>(std::log2(double(micros) + 1) * octave, sizeof(latency) / sizeof(latency[0]) - 1);
+	}
+	double percentile(double q) const {
+		size_t rank = std::ceil(q * served), accu = 0;
+		for (size_t b = 0; b < sizeof(latency) / sizeof(latency[0]); b++) {
+			accu += latency[b];
+			if (accu >= rank && accu) return std::exp2(double(b + 1) / octave) - 1;
+		}
+		return 0;
+	}
+
+	static volatile std::sig_atomic_t& stopping() { static volatile std::sig_atomic_t flag = 0; return flag; }
+	static void stop(int) { stopping() = 1; }
+	static bool stopped() { return stopping(); }
+
+private:
+	const player& play;
+	std::string path;
+	double report;
+	int listener;
+	std::vector<client> clients;
+	size_t latency[40 * octave] = { 0 };
+	size_t served = 0;
+	size_t batches = 0;
+};
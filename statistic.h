@@ -1,8 +1,17 @@
 #pragma once
 #include <list>
+#include <deque>
+#include <cmath>
 #include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
@@ -10,6 +19,9 @@
 
 class statistic {
 public:
+	struct record;
+	struct window;
+
 	/**
 	 * the total episodes to run
 	 * the block size of statistic
@@ -21,14 +33,15 @@ public:
 		: total(total),
 		  block(block ? block : total),
 		  limit(limit ? limit : total),
-		  count(0) {}
+		  count(0),
+		  tiles(true) {}
 
 public:
 	/**
 	 * show the statistic of last 'block' games
 	 *
 	 * the format would be
-	 * 1000   avg = 273901, max = 382324, ops = 241563 (170543|896715)
+	 * 1000   avg = 273901, max = 382324, p50 = 270336, p99 = 376832, ops = 241563 (170543|896715)
 	 *        512     100%   (0.3%)
 	 *        1024    99.7%  (0.2%)
 	 *        2048    99.5%  (1.1%)
@@ -40,76 +53,79 @@ public:
 	 *  '1000': current index (n)
 	 *  'avg = 273901': the average score is 273901
 	 *  'max = 382324': the maximum score is 382324
+	 *  'p50 = 270336': the median score is about 270336 (within 1/16 of an octave)
+	 *  'p99 = 376832': 99% of the scores are below about 376832
 	 *  'ops = 241563 (170543|896715)': the average speed is 241563
 	 *                                  the average speed of player is 170543
 	 *                                  the average speed of environment is 896715
+	 *                                  (n/a if the games are not clocked, e.g., with --seed)
 	 *  '93.7%': 93.7% (937 games) reached 8192-tiles (a.k.a. win rate of 8192-tile)
 	 *  '22.4%': 22.4% (224 games) terminated with 8192-tiles (the largest)
+	 *
+	 * the accumulators are updated when episodes are closed, so the cost does not depend on the block size
 	 */
 	void show(bool tstat = true) const {
-		std::array<int, 15> sequence({0, 1, 2, 3, 6, 12, 24, 48, 96, 192, 384, 768, 1536, 3072, 6144});
-		size_t blk = std::min(data.size(), block);
-		size_t stat[64] = { 0 };
-		size_t sop = 0, pop = 0, eop = 0;
-		time_t sdu = 0, pdu = 0, edu = 0;
-		board::reward sum = 0, max = 0;
-		auto it = data.end();
-		for (size_t i = 0; i < blk; i++) {
-			auto& ep = *(--it);
-			sum += ep.score();
-			max = std::max(ep.score(), max);
-			stat[*std::max_element(&(ep.state()(0)), &(ep.state()(16)))]++;
-			sop += ep.step();
-			pop += ep.step(action::slide::type);
-			eop += ep.step(action::place::type);
-			sdu += ep.time();
-			pdu += ep.time(action::slide::type);
-			edu += ep.time(action::place::type);
-		}
-
-		std::ios ff(nullptr);
-		ff.copyfmt(std::cout);
-		std::cout << std::fixed << std::setprecision(0);
-		std::cout << count << "\t";
-		std::cout << "avg = " << (sum / blk) << ", ";
-		std::cout << "max = " << (max) << ", ";
-		std::cout << "ops = " << (sop * 1000.0 / sdu);
-		std::cout <<     " (" << (pop * 1000.0 / pdu);
-		std::cout <<      "|" << (eop * 1000.0 / edu) << ")";
-		std::cout << std::endl;
-		std::cout.copyfmt(ff);
-
-		if (!tstat) return;
-		for (size_t t = 0, c = 0; c < blk; c += stat[t++]) {
-			if (stat[t] == 0) continue;
-			unsigned accu = std::accumulate(std::begin(stat) + t, std::end(stat), 0);
-			std::cout << "\t" <<  sequence[t]; // type
-			std::cout << "\t" << (accu * 100.0 / blk) << "%"; // win rate
-			std::cout << "\t" "(" << (stat[t] * 100.0 / blk) << "%" ")"; // percentage of ending
-			std::cout << std::endl;
-		}
-		std::cout << std::endl;
+		show(recent, tstat);
 	}
 
 	void summary() const {
-		auto block_temp = block;
-		const_cast<statistic&>(*this).block = data.size();
-		show();
-		const_cast<statistic&>(*this).block = block_temp;
+		show(stored, tiles);
 	}
 
+	/**
+	 * the sliding window over the last 'block' episodes, and over all stored episodes
+	 */
+	const window& last_block() const { return recent; }
+	const window& all_stored() const { return stored; }
+
 	bool is_finished() const {
 		return count >= total;
 	}
+	size_t remaining() const {
+		return total > count ? total - count : 0;
+	}
+
+	/**
+	 * continue from the given number of finished episodes, e.g., after a restart; the
+	 * episodes stored from now on are still limited by their own number
+	 */
+	void resume(size_t finished) {
+		count = std::max(count, std::min(finished, total));
+	}
 
 	void open_episode(const std::string& flag = "") {
-		if (count++ >= limit) data.pop_front();
-		data.emplace_back();
+		count++;
+		if (data.size() && data.size() >= limit) { // recycle the evicted episode together with its list node
+			data.splice(data.end(), data, data.begin());
+			data.back().reset();
+			stored.pop_front();
+		} else {
+			data.emplace_back();
+		}
 		data.back().open_episode(flag);
 	}
 
 	void close_episode(const std::string& flag = "") {
 		data.back().close_episode(flag);
+		account(data.back());
+		if (count % block == 0) show();
+	}
+
+	/**
+	 * take an episode played elsewhere, as if it were opened and closed here, e.g., from the
+	 * workers of parallel games; safe to call from several threads
+	 */
+	void add(episode&& ep) {
+		std::lock_guard<std::mutex> guard(lock);
+		count++;
+		if (data.size() && data.size() >= limit) {
+			data.splice(data.end(), data, data.begin());
+			data.back() = std::move(ep);
+			stored.pop_front();
+		} else {
+			data.push_back(std::move(ep));
+		}
+		account(data.back());
 		if (count % block == 0) show();
 	}
 
@@ -133,16 +149,214 @@ public:
 		for (std::string line; std::getline(in, line) && line.size(); ) {
 			stat.data.emplace_back();
 			std::stringstream(line) >> stat.data.back();
+			stat.account(stat.data.back());
 		}
 		stat.total = std::max(stat.total, stat.data.size());
 		stat.count = stat.data.size();
 		return in;
 	}
 
+	/**
+	 * load the records like operator >>, but parse a read-only mapping of the file in parallel
+	 * line chunks; without 'replay', no episode is kept and only the summary is rebuilt, which
+	 * then has no tile statistics since the largest tiles are only known by replaying the moves
+	 */
+	bool load(const std::string& path, bool replay = true) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		struct stat st;
+		if (fd < 0 || ::fstat(fd, &st) != 0) {
+			if (fd >= 0) ::close(fd);
+			return false;
+		}
+		size_t bytes = st.st_size;
+		void* ptr = bytes ? ::mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+		::close(fd);
+		if (ptr == MAP_FAILED) return false;
+		const char* base = static_cast<const char*>(ptr);
+
+		struct chunk {
+			const char* first;
+			const char* last;
+			bool stop;    // an empty line ends the records
+			std::vector<episode> episodes;
+			std::vector<record> records;
+		};
+		size_t threads = std::max<size_t>(std::min<size_t>(std::thread::hardware_concurrency(), bytes >> 20), 1);
+		std::vector<chunk> chunks(threads);
+		for (size_t i = 0, pos = 0; i < threads; i++) {
+			size_t end = (i + 1 == threads) ? bytes : std::max((bytes / threads) * (i + 1), pos);
+			while (end < bytes && base[end - 1] != '\n') end++;
+			chunks[i].first = base + pos;
+			chunks[i].last = base + end;
+			chunks[i].stop = false;
+			pos = end;
+		}
+		auto parse = [replay](chunk& c) {
+			episode ep;
+			for (const char* line = c.first; line < c.last; ) {
+				const char* end = std::find(line, c.last, '\n');
+				if (end == line) {
+					c.stop = true;
+					break;
+				}
+				if (replay) {
+					c.episodes.emplace_back();
+					c.episodes.back().parse(line, end);
+				} else {
+					ep.parse(line, end, false);
+					c.records.emplace_back(ep);
+				}
+				line = end + 1;
+			}
+		};
+		std::vector<std::thread> pool;
+		for (size_t i = 1; i < threads; i++) pool.emplace_back(parse, std::ref(chunks[i]));
+		parse(chunks[0]);
+		for (std::thread& t : pool) t.join();
+
+		size_t loaded = 0;
+		for (chunk& c : chunks) {
+			for (episode& ep : c.episodes) {
+				data.push_back(std::move(ep));
+				account(data.back());
+			}
+			for (const record& r : c.records) account(r);
+			loaded += c.episodes.size() + c.records.size();
+			if (c.stop) break;
+		}
+		if (ptr) ::munmap(ptr, bytes);
+		tiles = tiles && replay;
+		total = std::max(total, loaded);
+		count = loaded;
+		return true;
+	}
+
+public:
+	/**
+	 * the summary of a finished episode
+	 */
+	struct record {
+		board::reward score;
+		board::cell tile;
+		size_t sop, pop, eop;
+		time_t sdu, pdu, edu;
+
+		record(const episode& ep) : score(ep.score()), tile(ep.state().max_cell()),
+			sop(ep.step()), pop(ep.step(action::slide::type)), eop(ep.step(action::place::type)),
+			sdu(ep.time()), pdu(ep.time(action::slide::type)), edu(ep.time(action::place::type)) {}
+	};
+
+	/**
+	 * running sums, a tile histogram, a score sketch, and a monotonic queue for the maximum
+	 * over a FIFO window of records
+	 */
+	struct window {
+		static constexpr size_t octave = 16; // sketch buckets per power of 2
+
+		std::deque<record> recs;
+		std::deque<std::pair<size_t, board::reward>> peak; // (serial, score) with decreasing scores
+		size_t head = 0, tail = 0; // the serials of the oldest and the next record
+		board::reward sum = 0;
+		size_t stat[64] = { 0 };
+		size_t sketch[64 * octave] = { 0 };
+		size_t sop = 0, pop = 0, eop = 0;
+		time_t sdu = 0, pdu = 0, edu = 0;
+
+		size_t size() const { return recs.size(); }
+		board::reward max() const { return peak.size() ? peak.front().second : 0; }
+
+		void push_back(const record& r) {
+			recs.push_back(r);
+			while (peak.size() && peak.back().second <= r.score) peak.pop_back();
+			peak.emplace_back(tail++, r.score);
+			apply(r, +1);
+		}
+		void pop_front() {
+			if (recs.empty()) return;
+			if (peak.front().first == head) peak.pop_front();
+			apply(recs.front(), -1);
+			recs.pop_front();
+			head++;
+		}
+
+		/**
+		 * the score below which the given fraction of the window lies
+		 */
+		board::reward percentile(double q) const {
+			size_t rank = std::ceil(q * recs.size()), accu = 0;
+			for (size_t b = 0; b < 64 * octave; b++) {
+				accu += sketch[b];
+				if (accu >= rank && accu) return std::round(std::exp2(double(b + 1) / octave)) - 1;
+			}
+			return max();
+		}
+
+	private:
+		static size_t bucket(board::reward score) {
+			return std::min<size_t>(std::log2(double(score) + 1) * octave, 64 * octave - 1);
+		}
+		void apply(const record& r, int sign) {
+			sum += sign * r.score;
+			stat[std::min<size_t>(r.tile, 63)] += sign;
+			sketch[bucket(r.score)] += sign;
+			sop += sign * r.sop, pop += sign * r.pop, eop += sign * r.eop;
+			sdu += sign * r.sdu, pdu += sign * r.pdu, edu += sign * r.edu;
+		}
+	};
+
+private:
+	void account(const episode& ep) {
+		account(record(ep));
+	}
+	void account(const record& r) {
+		recent.push_back(r);
+		if (recent.size() > block) recent.pop_front();
+		stored.push_back(r);
+	}
+
+	void show(const window& win, bool tstat = true) const {
+		std::array<int, 15> sequence({0, 1, 2, 3, 6, 12, 24, 48, 96, 192, 384, 768, 1536, 3072, 6144});
+		size_t blk = win.size();
+
+		std::ios ff(nullptr);
+		ff.copyfmt(std::cout);
+		std::cout << std::fixed << std::setprecision(0);
+		std::cout << count << "\t";
+		std::cout << "avg = " << (win.sum / board::reward(blk)) << ", ";
+		std::cout << "max = " << (win.max()) << ", ";
+		std::cout << "p50 = " << (win.percentile(0.5)) << ", ";
+		std::cout << "p99 = " << (win.percentile(0.99)) << ", ";
+		if (episode::clocked()) {
+			std::cout << "ops = " << (win.sop * 1000.0 / win.sdu);
+			std::cout <<     " (" << (win.pop * 1000.0 / win.pdu);
+			std::cout <<      "|" << (win.eop * 1000.0 / win.edu) << ")";
+		} else {
+			std::cout << "ops = n/a";
+		}
+		std::cout << std::endl;
+		std::cout.copyfmt(ff);
+
+		if (!tstat) return;
+		const size_t* stat = win.stat;
+		for (size_t t = 0, c = 0; c < blk; c += stat[t++]) {
+			if (stat[t] == 0) continue;
+			unsigned accu = std::accumulate(stat + t, stat + 64, 0);
+			std::cout << "\t" <<  sequence[t]; // type
+			std::cout << "\t" << (accu * 100.0 / blk) << "%"; // win rate
+			std::cout << "\t" "(" << (stat[t] * 100.0 / blk) << "%" ")"; // percentage of ending
+			std::cout << std::endl;
+		}
+		std::cout << std::endl;
+	}
+
 private:
 	size_t total;
 	size_t block;
 	size_t limit;
 	size_t count;
+	bool tiles; // whether the largest tiles are known
 	std::list<episode> data;
+	window recent;
+	window stored;
+	std::mutex lock;
 };
@@ -11,36 +11,437 @@
 #include <iostream>
 #include <vector>
 #include <utility>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "numa.h"
 
+/**
+ * weight table backed by an anonymous mapping
+ *
+ * the pages stay untouched (and read as zero) until they are written, so the
+ * placement policy decides where they land instead of the thread that created them
+ */
 class weight {
 public:
-	weight() {}
-	weight(size_t len) : value(len) {}
-	weight(weight&& f) : value(std::move(f.value)) {}
-	weight(const weight& f) = default;
+	weight(numa::policy placement = numa::none) : value(nullptr), length(0), placement(placement), region(nullptr), bytes(0),
+		directory(nullptr), blocks(nullptr), shift(0), slots(0), tier_shift(0), tier_id(0), borrowed(false) {}
+	weight(size_t len, numa::policy placement = numa::none) : weight(placement) { allocate(len); }
+	weight(weight&& f) noexcept : weight() { swap(f); }
+	weight(const weight& f) : weight(f.placement) { allocate(f.length); f.copy(value, 0, length); }
+	~weight() { release(); }
 
-	weight& operator =(const weight& f) = default;
+	weight& operator =(weight f) { swap(f); return *this; }
 	float& operator[] (size_t i) { return value[i]; }
-	const float& operator[] (size_t i) const { return value[i]; }
-	size_t size() const { return value.size(); }
+	const float& operator[] (size_t i) const { return (value && copies.empty() && !slots) ? value[i] : lookup(i); }
+	void prefetch(size_t i) const { __builtin_prefetch(address(i)); }
+	size_t size() const { return length; }
+	float* data() { return value; }
+	const float* data() const { return value; }
+	bool sparse() const { return directory; }
+
+	void swap(weight& f) noexcept {
+		std::swap(value, f.value);
+		std::swap(length, f.length);
+		std::swap(placement, f.placement);
+		std::swap(copies, f.copies);
+		std::swap(region, f.region);
+		std::swap(bytes, f.bytes);
+		std::swap(directory, f.directory);
+		std::swap(blocks, f.blocks);
+		std::swap(shift, f.shift);
+		std::swap(slots, f.slots);
+		std::swap(tier_shift, f.tier_shift);
+		std::swap(tier_id, f.tier_id);
+		std::swap(borrowed, f.borrowed);
+	}
+
+	/**
+	 * a table that reads and writes the entries of another one, which must outlive it
+	 */
+	static weight view(const weight& w) {
+		weight v(w.placement);
+		v.value = w.value;
+		v.length = w.length;
+		v.copies = w.copies;
+		v.directory = w.directory;
+		v.blocks = w.blocks;
+		v.shift = w.shift;
+		v.slots = w.slots;
+		v.tier_shift = w.tier_shift;
+		v.tier_id = w.tier_id;
+		v.borrowed = true;
+		return v;
+	}
+
+	/**
+	 * copy the entries [first, first + len) to the buffer, whatever the layout is
+	 */
+	void copy(float* buf, size_t first, size_t len) const {
+		if (value) {
+			if (len) std::memcpy(buf, value + first, sizeof(float) * len);
+			return;
+		}
+		for (size_t i = 0; i < len; i++) buf[i] = cold(first + i);
+	}
+
+	/**
+	 * map a table of len floats stored at the given offset of a file instead of reading it
+	 * the mapping is private, so updates stay in memory and never reach the file
+	 */
+	bool attach(int fd, off_t offset, size_t len) {
+		release();
+		off_t page = sysconf(_SC_PAGESIZE), base = offset / page * page;
+		size_t size = offset - base + sizeof(float) * len;
+		void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, base);
+		if (ptr == MAP_FAILED) return false;
+		region = static_cast<char*>(ptr);
+		bytes = size;
+		value = reinterpret_cast<float*>(region + (offset - base));
+		length = len;
+		return true;
+	}
+
+	/**
+	 * the bytes of the table that are resident in memory, i.e., the footprint of the touched pages
+	 */
+	size_t resident() const {
+		const char* addr = value ? reinterpret_cast<const char*>(value) : region;
+		if (!addr) return 0;
+		size_t page = sysconf(_SC_PAGESIZE), skew = reinterpret_cast<uintptr_t>(addr) % page;
+		size_t len = (value ? sizeof(float) * length : bytes) + skew;
+		std::vector<unsigned char> pages((len + page - 1) / page);
+		if (mincore(const_cast<char*>(addr - skew), len, pages.data()) != 0) return 0;
+		size_t count = 0;
+		for (unsigned char p : pages) count += p & 1;
+		return count * page;
+	}
+
+	/**
+	 * make a copy bound to each node, reads through const access then stay on the local node
+	 * only meaningful for evaluation, since updates are not propagated to the copies
+	 */
+	void replicate() {
+		drop_copies();
+		if (numa::nodes() <= 1) return;
+		for (int n = 0; n < numa::nodes(); n++) {
+			float* copy = map(length);
+			numa::place(copy, sizeof(float) * length, numa::local, n);
+			this->copy(copy, 0, length);
+			copies.push_back(copy);
+		}
+	}
+
+	/**
+	 * put a hot tier of about the given bytes in front of the table for reads through const access
+	 *
+	 * the hot tier is a direct-mapped cache of blocks of 2^block entries, kept by each thread on
+	 * its own; a hit warms the slot, a miss cools it, and the missing block is copied in from the
+	 * cold tier (the mapped file or the sparse blocks) once the slot has cooled down to zero
+	 *
+	 * at most max_tiers tables have a hot tier at a time, the id of a tier is reused after its
+	 * table is released; the other threads drop their stale copy when they see the id again
+	 */
+	bool cache(size_t bytes, unsigned block = 6) {
+		drop_tier();
+		size_t count = 1;
+		while (count * 2 * (sizeof(float) << block) <= bytes) count *= 2;
+		if (bytes < (sizeof(float) << block)) return false;
+		registry& ids = tier_ids();
+		std::lock_guard<std::mutex> guard(ids.lock);
+		unsigned id = std::find(ids.used.begin(), ids.used.end(), false) - ids.used.begin();
+		if (id == max_tiers) {
+			std::cerr << "cache: no hot tier left, at most " << max_tiers << " tables can have one at a time" << std::endl;
+			return false;
+		}
+		ids.used[id] = true;
+		ids.generation[id].fetch_add(1, std::memory_order_relaxed);
+		tier_id = id;
+		slots = count;
+		tier_shift = block;
+		return true;
+	}
+
+	/**
+	 * the hits and the misses of the hot tier of the calling thread, optionally restarting the count
+	 */
+	std::pair<size_t, size_t> cache_usage(bool reset = false) const {
+		if (!slots) return { 0, 0 };
+		tier& t = hot();
+		std::pair<size_t, size_t> usage(t.hits, t.misses);
+		if (reset) t.hits = t.misses = 0;
+		return usage;
+	}
+
+	/**
+	 * the blocked sparse layout: a header, a directory with the slot of each block (or
+	 * ~0u if the block is all zero), and the stored blocks; a read is a two-level lookup
+	 */
+	struct sparse_head {
+		uint64_t length;
+		uint32_t block; // entries per block, a power of 2
+		uint32_t reserved;
+		uint64_t stored;
+	};
+	struct sparse_info {
+		size_t blocks; // blocks in the table
+		size_t stored; // blocks kept
+		size_t kept;   // nonzero entries kept
+		size_t pruned; // nonzero entries dropped as near-zero
+	};
+
+	/**
+	 * write the table in the sparse layout, where entries with |w| <= eps are dropped
+	 */
+	sparse_info write_sparse(std::ostream& out, uint32_t block = 256, float eps = 0) const {
+		sparse_info info = { (length + block - 1) / block, 0, 0, 0 };
+		std::vector<uint32_t> dir(info.blocks, ~0u);
+		std::vector<float> buf(block);
+		for (size_t b = 0; b < info.blocks; b++) {
+			size_t n = std::min<size_t>(block, length - b * block);
+			copy(buf.data(), b * block, n);
+			for (size_t i = 0; i < n; i++) {
+				if (buf[i] == 0) continue;
+				if (std::abs(buf[i]) <= eps) info.pruned++;
+				else info.kept++, dir[b] = 0;
+			}
+			if (dir[b] == 0) dir[b] = info.stored++;
+		}
+		sparse_head head = { length, block, 0, info.stored };
+		out.write(reinterpret_cast<const char*>(&head), sizeof(head));
+		out.write(reinterpret_cast<const char*>(dir.data()), sizeof(uint32_t) * dir.size());
+		for (size_t b = 0; b < info.blocks; b++) {
+			if (dir[b] == ~0u) continue;
+			size_t n = std::min<size_t>(block, length - b * block);
+			std::fill(buf.begin(), buf.end(), 0.0f);
+			copy(buf.data(), b * block, n);
+			for (float& v : buf) if (std::abs(v) <= eps) v = 0;
+			out.write(reinterpret_cast<const char*>(buf.data()), sizeof(float) * block);
+		}
+		return info;
+	}
+
+	/**
+	 * map a table stored in the sparse layout at the given offset of a file, and return
+	 * its size in bytes (0 on failure); the table is read-only until densify() is called
+	 * the table must end within the file and its directory must point to stored blocks,
+	 * since a read past the end of a mapped file would raise SIGBUS instead of failing here
+	 */
+	size_t attach_sparse(int fd, off_t offset) {
+		release();
+		sparse_head head;
+		struct stat info;
+		if (pread(fd, &head, sizeof(head), offset) != sizeof(head) || fstat(fd, &info) != 0) return 0;
+		if (head.block == 0 || (head.block & (head.block - 1))) return 0;
+		uint64_t count = head.length / head.block + (head.length % head.block != 0);
+		uint64_t room = uint64_t(info.st_size - offset) - sizeof(head); // pread ensures that the header fits
+		if (count > room / sizeof(uint32_t)) return 0;
+		room -= sizeof(uint32_t) * count;
+		if (head.stored > room / sizeof(float) / head.block) return 0;
+		size_t table = sizeof(head) + sizeof(uint32_t) * count + sizeof(float) * head.block * head.stored;
+		off_t page = sysconf(_SC_PAGESIZE), base = offset / page * page;
+		size_t size = offset - base + table;
+		void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, base);
+		if (ptr == MAP_FAILED) return 0;
+		region = static_cast<char*>(ptr);
+		bytes = size;
+		directory = reinterpret_cast<const uint32_t*>(region + (offset - base) + sizeof(head));
+		blocks = reinterpret_cast<const float*>(directory + count);
+		length = head.length;
+		while ((1u << shift) < head.block) shift++;
+		for (uint64_t b = 0; b < count; b++) {
+			if (directory[b] != ~0u && directory[b] >= head.stored) return release(), 0;
+		}
+		return table;
+	}
+
+	/**
+	 * turn a sparse table into a dense writable one
+	 */
+	void densify() {
+		if (value) return;
+		weight dense(length, placement);
+		size_t block = size_t(1) << shift;
+		for (size_t b = 0, first = 0; first < length; b++, first += block) { // empty blocks stay untouched zero pages
+			if (directory[b] != ~0u) copy(dense.value + first, first, std::min(block, length - first));
+		}
+		swap(dense);
+	}
 
 public:
 	friend std::ostream& operator <<(std::ostream& out, const weight& w) {
-		auto& value = w.value;
-		uint64_t size = value.size();
+		uint64_t size = w.length;
 		out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
-		out.write(reinterpret_cast<const char*>(value.data()), sizeof(float) * size);
+		if (w.value) {
+			out.write(reinterpret_cast<const char*>(w.value), sizeof(float) * size);
+			return out;
+		}
+		std::vector<float> buf(4096);
+		for (size_t i = 0; i < size; i += buf.size()) {
+			size_t n = std::min(buf.size(), size - i);
+			w.copy(buf.data(), i, n);
+			out.write(reinterpret_cast<const char*>(buf.data()), sizeof(float) * n);
+		}
 		return out;
 	}
 	friend std::istream& operator >>(std::istream& in, weight& w) {
-		auto& value = w.value;
 		uint64_t size = 0;
 		in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
-		value.resize(size);
-		in.read(reinterpret_cast<char*>(value.data()), sizeof(float) * size);
+		if (size != w.length) w.release(), w.allocate(size);
+		in.read(reinterpret_cast<char*>(w.value), sizeof(float) * size);
 		return in;
 	}
 
+	/**
+	 * where a read of an entry would go, without counting a hit or a miss of the hot tier
+	 * or filling a slot, e.g., to prefetch it
+	 */
+	const float* address(size_t i) const {
+		if (value && copies.empty() && !slots) return value + i;
+		if (!copies.empty()) return &copies[numa::current()][i];
+		if (slots) {
+			const std::unique_ptr<tier>& t = local_tiers()[tier_id];
+			size_t block = i >> tier_shift, s = block & (slots - 1);
+			if (t && t->generation == tier_ids().generation[tier_id].load(std::memory_order_relaxed) && t->tags[s] == block + 1)
+				return t->data.data() + (s << tier_shift) + (i & ((size_t(1) << tier_shift) - 1));
+		}
+		return &cold(i);
+	}
+
+protected:
+	const float& lookup(size_t i) const {
+		if (!copies.empty()) return copies[numa::current()][i];
+		if (slots) return cached(i);
+		return cold(i);
+	}
+	const float& cold(size_t i) const {
+		static const float zero = 0;
+		if (value) return value[i];
+		uint32_t slot = directory[i >> shift];
+		return slot == ~0u ? zero : blocks[(size_t(slot) << shift) | (i & ((size_t(1) << shift) - 1))];
+	}
+
+	struct tier {
+		std::vector<uint64_t> tags; // the block number + 1 held by each slot, 0 if none
+		std::vector<uint8_t> heat;  // the recent hits of each slot, saturated at 255
+		std::vector<float> data;
+		size_t hits = 0;
+		size_t misses = 0;
+		uint64_t generation = 0; // that of the id when the tier was made
+	};
+	static constexpr unsigned max_tiers = 64;
+
+	struct registry {
+		std::mutex lock;
+		std::array<bool, max_tiers> used;
+		std::array<std::atomic<uint64_t>, max_tiers> generation; // bumped whenever an id is assigned
+	};
+	static registry& tier_ids() {
+		static registry ids; // zero-initialized as a static
+		return ids;
+	}
+	static std::array<std::unique_ptr<tier>, max_tiers>& local_tiers() {
+		static thread_local std::array<std::unique_ptr<tier>, max_tiers> tiers;
+		return tiers;
+	}
+
+	/**
+	 * free the hot tier of the calling thread and return the id, the tiers of the other threads
+	 * are freed once they see the id assigned again, or when they exit
+	 */
+	void drop_tier() {
+		if (!slots || borrowed) return slots = 0, void();
+		local_tiers()[tier_id].reset();
+		registry& ids = tier_ids();
+		std::lock_guard<std::mutex> guard(ids.lock);
+		ids.used[tier_id] = false;
+		slots = 0;
+	}
+
+	tier& hot() const {
+		std::unique_ptr<tier>& t = local_tiers()[tier_id];
+		uint64_t generation = tier_ids().generation[tier_id].load(std::memory_order_relaxed);
+		if (!t || t->generation != generation) {
+			t.reset(new tier());
+			t->generation = generation;
+			t->tags.assign(slots, 0);
+			t->heat.assign(slots, 0);
+			t->data.assign(slots << tier_shift, 0);
+		}
+		return *t;
+	}
+
+	const float& cached(size_t i) const {
+		tier& t = hot();
+		size_t block = i >> tier_shift, s = block & (slots - 1);
+		float* data = t.data.data() + (s << tier_shift);
+		size_t offset = i & ((size_t(1) << tier_shift) - 1);
+		if (t.tags[s] == block + 1) {
+			t.hits++;
+			if (t.heat[s] < 255) t.heat[s]++;
+			return data[offset];
+		}
+		if (!value && directory[i >> shift] == ~0u) return cold(i); // an empty sparse block is not worth a slot
+		t.misses++;
+		if (t.heat[s] && --t.heat[s]) return cold(i);
+		size_t first = block << tier_shift, n = std::min(size_t(1) << tier_shift, length - first);
+		for (size_t k = 0; k < n; k++) data[k] = cold(first + k);
+		t.tags[s] = block + 1;
+		t.heat[s] = 1;
+		return data[offset];
+	}
+
+	static float* map(size_t len) {
+		if (len == 0) return nullptr;
+		void* ptr = mmap(nullptr, sizeof(float) * len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (ptr == MAP_FAILED) throw std::bad_alloc();
+		return static_cast<float*>(ptr);
+	}
+	void allocate(size_t len) {
+		value = map(len);
+		length = len;
+		if (value) numa::place(value, sizeof(float) * length, placement);
+	}
+	void release() {
+		if (borrowed) copies.clear(), region = nullptr, value = nullptr;
+		drop_tier();
+		borrowed = false;
+		drop_copies();
+		if (region) munmap(region, bytes);
+		else if (value) munmap(value, sizeof(float) * length);
+		region = nullptr;
+		bytes = 0;
+		directory = nullptr;
+		blocks = nullptr;
+		shift = 0;
+		slots = 0;
+		value = nullptr;
+		length = 0;
+	}
+	void drop_copies() {
+		for (float* copy : copies) munmap(copy, sizeof(float) * length);
+		copies.clear();
+	}
+
 protected:
-	std::vector<float> value;
-};
\ No newline at end of file
+	float* value;
+	size_t length;
+	numa::policy placement;
+	std::vector<float*> copies;
+	char* region; // the file mapping that contains the table, if attached
+	size_t bytes;
+	const uint32_t* directory; // the block slots of a sparse table
+	const float* blocks;       // the stored blocks of a sparse table
+	unsigned shift;            // log2 of the block size
+	size_t slots;              // the slots of the hot tier, 0 if there is none
+	unsigned tier_shift;       // log2 of the block size of the hot tier
+	unsigned tier_id;          // the index of the hot tier among those of a thread
+	bool borrowed;             // whether the entries belong to another table
+};